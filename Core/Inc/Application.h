@@ -21,11 +21,24 @@ extern I2S_HandleTypeDef hi2s1;
 #include "GpioPin.h"
 #include "Led.h"
 #include "LiveLed.h"
+#include "EventQueue.h"
 #include "Button.h"
 #include "MuteButton.h"
+#include "StLibraryAdapter.h"
+#include "VolumeLimiter.h"
 #include "VolumeControl.h"
+#include "BiquadEqualizer.h"
 #include <GraphicEqualizer.h>
+#include "I2sUnpack.h"
+#include "HighPassFilter.h"
+#include "VoiceActivityDetector.h"
+#include "NoiseGate.h"
+#include "GainRamp.h"
+#include "Dither.h"
+#include "CpuLoad.h"
+#include "Profiler.h"
 #include "Audio.h"
+#include "PowerManager.h"
 #include "Program.h"
 
 // for the Debug_Semihosting configuration
@@ -9,23 +9,55 @@
 /**
  * Audio management functionality. Many of the methods in here are called from the
  * usbd_audio_if.cpp file.
+ *
+ * The DMA interrupt only records which half of the buffer is ready and pends PendSV. The
+ * processing runs in the PendSV handler at the lowest priority so that the USB interrupt is
+ * never held off by it. Settings that the USB interrupt changes while a block is being
+ * processed are picked up at the start of the next block.
  */
 
 class Audio {
 
   private:
-    // 20ms of 64 bit samples
+    // 20ms of 64 bit samples at the highest sample rate
 
     volatile int32_t *_sampleBuffer;
-    int16_t *_processBuffer;
-    int16_t *_sendBuffer;
+    int32_t *_processBuffer;
 
     const MuteButton &_muteButton;
     const LiveLed &_liveLed;
     GraphicEqualizer &_graphicEqualiser;
     VolumeControl &_volumeControl;
-    bool _running;
-    uint8_t _zeroCounter;
+    volatile bool _running;
+    uint32_t _sampleRate;
+    uint16_t _samplesPerPacket;
+    volatile uint8_t _subframeSize;
+    volatile bool _hostMuted;
+    bool _buttonMuted;
+    uint32_t _sampleCount;
+    uint32_t _dmaPosition;
+    volatile int32_t *volatile _readyBlock;
+    volatile uint32_t _readyFrame;
+    volatile uint32_t _blockFrame;
+    volatile uint16_t _blockPosition;
+    volatile uint32_t _blocksReady;
+    volatile uint32_t _blocksDone;
+    volatile uint32_t _blocksSent;
+    int16_t _volume;
+    volatile int16_t _pendingVolume;
+    volatile bool _volumePending;
+    volatile bool _retunePending;
+    volatile bool _restartPending;
+    HighPassFilter _highPassFilter;
+    HighPassSettings _pendingHighPass;
+    volatile bool _highPassPending;
+    VoiceActivityDetector _voiceActivityDetector;
+    NoiseGate _noiseGate;
+    NoiseGateSettings _pendingGate;
+    volatile bool _gatePending;
+    GainRamp _gainRamp;
+    Dither _dither;
+    Profiler _profiler;
 
   public:
     static Audio *_instance;
@@ -35,10 +67,19 @@ class Audio {
         VolumeControl &volumeControl);
 
     void setLed() const;
+    bool isRunning() const;
     void setVolume(int16_t volume);
+    void setEqualizerBand(uint8_t band, int8_t gain);
+    void setHostMute(bool muted);
+    void setSubframeSize(uint8_t subframeSize);
+    int8_t setSampleRate(uint32_t sampleRate);
+    uint32_t getSampleCount();
+    uint32_t getFrameTime() const;
+    uint32_t getBlocksSent() const;
 
     void i2s_halfComplete();
     void i2s_complete();
+    void processBlocks();
 
     int8_t start();
     int8_t stop();
@@ -46,9 +87,21 @@ class Audio {
     int8_t resume();
 
     const GraphicEqualizer& getGraphicEqualizer() const;
+    void setHighPass(const HighPassSettings &settings);
+    HighPassSettings getHighPass() const;
+    const VoiceActivityDetector& getVoiceActivityDetector() const;
+    void setNoiseGate(const NoiseGateSettings &settings);
+    const NoiseGateSettings& getNoiseGate() const;
+    GainRamp& getGainRamp();
+    Dither& getDither();
+    Profiler& getProfiler();
 
   private:
-    void sendData(volatile int32_t *data_in, int16_t *data_out);
+    bool isMuted() const;
+    uint16_t followMuteButton(uint32_t blockFrame, uint16_t nSamples);
+    void blockReady(volatile int32_t *block);
+    void applySettings();
+    void sendData(const int32_t *data_in, uint32_t blockFrame);
 };
 
 /**
@@ -57,19 +110,40 @@ class Audio {
 
 inline Audio::Audio(const MuteButton &muteButton, const LiveLed &liveLed, GraphicEqualizer &graphicEqualiser,
     VolumeControl &volumeControl) :
-    _muteButton(muteButton), _liveLed(liveLed), _graphicEqualiser(graphicEqualiser), _volumeControl(volumeControl) {
+    _muteButton(muteButton), _liveLed(liveLed), _graphicEqualiser(graphicEqualiser), _volumeControl(volumeControl),
+    _highPassFilter(MIC_SAMPLE_FREQUENCY), _voiceActivityDetector(MIC_SAMPLE_FREQUENCY),
+    _noiseGate(MIC_SAMPLE_FREQUENCY), _gainRamp(MIC_SAMPLE_FREQUENCY) {
 
   // initialise variables
 
   Audio::_instance = this;
   _running = false;
-  _zeroCounter = 0;
+  _sampleCount = 0;
+  _dmaPosition = 0;
+  _readyBlock = nullptr;
+  _readyFrame = 0;
+  _blockFrame = 0;
+  _blockPosition = 0;
+  _blocksReady = 0;
+  _blocksDone = 0;
+  _blocksSent = 0;
+  _volume = 1;   // as set by the VolumeControl constructor
+  _pendingVolume = 0;
+  _volumePending = false;
+  _retunePending = false;
+  _restartPending = false;
+  _highPassPending = false;
+  _gatePending = false;
+  _subframeSize = 2;
+  _hostMuted = false;
+  _buttonMuted = false;
+  _sampleRate = MIC_SAMPLE_FREQUENCY;
+  _samplesPerPacket = MIC_SAMPLES_PER_PACKET;
 
   // allocate buffers
 
-  _sampleBuffer = new int32_t[MIC_SAMPLES_PER_PACKET * 2];      // 7680 bytes (*2 because samples are 64 bit)
-  _processBuffer = new int16_t[MIC_SAMPLES_PER_PACKET];         // 1920 bytes
-  _sendBuffer = new int16_t[MIC_SAMPLES_PER_PACKET];            // 1920 bytes
+  _sampleBuffer = new int32_t[MIC_MAX_SAMPLES_PER_PACKET * 2];      // 15360 bytes (*2 because samples are 64 bit)
+  _processBuffer = new int32_t[MIC_MAX_SAMPLES_PER_PACKET / 2];     // 3840 bytes, Q31 samples for in-place processing
 
   // set LR to low (it's pulled low anyway)
 
@@ -77,7 +151,8 @@ inline Audio::Audio(const MuteButton &muteButton, const LiveLed &liveLed, Graphi
 }
 
 /**
- * Start the I2S DMA transfer (called from usbd_audio_if.cpp)
+ * Start the I2S DMA transfer (called from usbd_audio_if.cpp). The stream fades in from
+ * silence.
  */
 
 inline int8_t Audio::start() {
@@ -86,7 +161,10 @@ inline int8_t Audio::start() {
 
   // HAL_I2S_Receive_DMA will multiply the size by 2 because the standard is 24 bit Philips.
 
-  if ((status = HAL_I2S_Receive_DMA(&hi2s1, (uint16_t*) _sampleBuffer, MIC_SAMPLES_PER_PACKET * 2)) == HAL_OK) {
+  if ((status = HAL_I2S_Receive_DMA(&hi2s1, (uint16_t*) _sampleBuffer, _samplesPerPacket * 2)) == HAL_OK) {
+    _dmaPosition = 0;
+    _blockPosition = 0;
+    _restartPending = true;
     _running = true;
   }
 
@@ -137,15 +215,70 @@ inline int8_t Audio::resume() {
 }
 
 /**
- * Light the live LED if we are unmuted (hard and soft)
+ * Light the live LED if we are unmuted (hard and soft), fully while there's speech and dimly
+ * while it's quiet
  */
 
 inline void Audio::setLed() const {
-  _liveLed.setState(_running && !_muteButton.isMuted());
+  _liveLed.show(_running && !isMuted(), _voiceActivityDetector.isActive());
+}
+
+/**
+ * True while the I2S is running and blocks are being processed
+ */
+
+inline bool Audio::isRunning() const {
+  return _running;
 }
 
 /**
- * Set the volume gain: the mute state is preserved
+ * Mute or unmute at the host's request (called from the USB interrupt). The I2S keeps running
+ * and the stream keeps flowing so that unmuting is immediate. The change is picked up at the
+ * next block in the same way as the mute button.
+ */
+
+inline void Audio::setHostMute(bool muted) {
+  _hostMuted = muted;
+}
+
+/**
+ * Either the button or the host can mute the microphone
+ */
+
+inline bool Audio::isMuted() const {
+  return _muteButton.isMuted() || _hostMuted;
+}
+
+/**
+ * Follow the mute button from the frame on which it was pressed or released. The event
+ * arrives after the debounce delay so that frame is normally in this block, or in one that has
+ * already been sent in which case the change starts with this block. A change stamped after
+ * the end of this block waits for the next one. A restart of the stream fades in from silence
+ * so any change while it was stopped is taken up then, in applySettings().
+ * @return The offset into the block at which the button's state takes effect
+ */
+
+inline uint16_t Audio::followMuteButton(uint32_t blockFrame, uint16_t nSamples) {
+
+  bool muted = _muteButton.isMuted();
+
+  if (muted == _buttonMuted) {
+    return 0;
+  }
+
+  int32_t offset = (int32_t) (_muteButton.getChangeTime() - blockFrame);
+
+  if (offset >= nSamples) {
+    return 0;
+  }
+
+  _buttonMuted = muted;
+  return offset > 0 ? offset : 0;
+}
+
+/**
+ * Set the volume gain: the mute state is preserved. This is called from the USB interrupt,
+ * which can preempt the processing, so the SVC library is updated at the next block.
  */
 
 inline void Audio::setVolume(int16_t volume) {
@@ -162,7 +295,186 @@ inline void Audio::setVolume(int16_t volume) {
     volume = 72;
   }
 
-  _volumeControl.setVolume(volume);
+  _pendingVolume = volume;
+  _volumePending = true;
+}
+
+/**
+ * Set the gain of one graphic equalizer band in dB (called from the USB interrupt). The
+ * equalizer holds it until the start of the next block.
+ */
+
+inline void Audio::setEqualizerBand(uint8_t band, int8_t gain) {
+  _graphicEqualiser.setBand(band, gain);
+}
+
+/**
+ * Set the number of bytes per sample sent to the host (2, 3 or 4). This follows the alternate
+ * setting selected by the host and takes effect from the next block.
+ */
+
+inline void Audio::setSubframeSize(uint8_t subframeSize) {
+  _subframeSize = subframeSize;
+}
+
+/**
+ * Change the sample rate (called from usbd_audio_if.cpp). The I2S is stopped, reclocked and
+ * restarted if it was running and the filters are retuned at the next block. The buffers are
+ * allocated for the highest rate so only the amount of each one that's used changes.
+ */
+
+inline int8_t Audio::setSampleRate(uint32_t sampleRate) {
+
+  if (sampleRate == _sampleRate) {
+    return HAL_OK;
+  }
+
+  HAL_StatusTypeDef status;
+  bool wasRunning = _running;
+
+  if (wasRunning && (status = HAL_I2S_DMAStop(&hi2s1)) != HAL_OK) {
+    return status;
+  }
+
+  _running = false;
+
+  if ((status = MX_I2S1_SetSampleRate(sampleRate)) != HAL_OK) {
+    return status;
+  }
+
+  _sampleRate = sampleRate;
+  _samplesPerPacket = sampleRate * MIC_MS_PER_PACKET / 1000;
+
+  _retunePending = true;
+
+  return wasRunning ? start() : HAL_OK;
+}
+
+/**
+ * A free-running count of the frames received by the DMA, called from the USB SOF interrupt
+ * to measure the I2S rate against the host's clock. The position in the circular buffer comes
+ * from the stream's count of remaining half-words, four to a frame. It can't move by as much
+ * as a whole buffer between two SOFs so the distance from the last position is unambiguous.
+ */
+
+inline uint32_t Audio::getSampleCount() {
+
+  if (_running) {
+
+    uint32_t bufferFrames = hi2s1.RxXferSize / 4;
+    uint32_t position = (hi2s1.RxXferSize - __HAL_DMA_GET_COUNTER(hi2s1.hdmarx)) / 4;
+
+    _sampleCount += (position + bufferFrames - _dmaPosition) % bufferFrames;
+    _dmaPosition = position;
+  }
+  return _sampleCount;
+}
+
+/**
+ * The number of the frame that the DMA is receiving now, counting only the frames received
+ * while streaming, as the time of a mute button edge (called from its EXTI interrupt). It's the
+ * first frame of the block being filled plus the distance that the DMA has gone into it.
+ * That distance is taken modulo the whole buffer so that it's still right if the DMA has
+ * crossed into the next block and its interrupt hasn't run yet. The block's frame is written
+ * last by blockReady() so a change of it means the interrupt came in between and the reading
+ * is taken again. The time stands still while the I2S is stopped.
+ */
+
+inline uint32_t Audio::getFrameTime() const {
+
+  uint32_t frame, offset;
+
+  do {
+
+    frame = _blockFrame;
+    offset = 0;
+
+    if (_running) {
+
+      uint32_t bufferFrames = hi2s1.RxXferSize / 4;
+      uint32_t position = (hi2s1.RxXferSize - __HAL_DMA_GET_COUNTER(hi2s1.hdmarx)) / 4;
+
+      offset = (position + bufferFrames - _blockPosition) % bufferFrames;
+    }
+  } while (frame != _blockFrame);
+
+  return frame + offset;
+}
+
+/**
+ * A free-running count of the blocks that have been committed to the USB FIFO
+ */
+
+inline uint32_t Audio::getBlocksSent() const {
+  return _blocksSent;
+}
+
+/**
+ * Apply the settings that the USB interrupt has changed since the last block. The retune
+ * reinitialises the SVC library so the volume is applied after it. The native volume limiter
+ * applies a volume change at once so the gain ramp starts from the old level to stop it
+ * being a step. The ST SVC library smooths its own volume changes and is left to it, because
+ * compensating for it as well would ramp the level twice in opposite directions.
+ */
+
+inline void Audio::applySettings() {
+
+  // the USB interrupt preempts this so the settings are taken with it masked, otherwise a
+  // change could land half way through the copy of the filter or gate settings or between
+  // the read of a value and the clear of its flag. They're applied afterwards with it unmasked.
+
+  __disable_irq();
+
+  bool retune = _retunePending;
+  bool restart = _restartPending;
+  bool highPassChanged = _highPassPending;
+  bool gateChanged = _gatePending;
+  bool volumeChanged = _volumePending;
+  HighPassSettings highPass = _pendingHighPass;
+  NoiseGateSettings gate = _pendingGate;
+  int16_t volume = _pendingVolume;
+
+  _retunePending = false;
+  _restartPending = false;
+  _highPassPending = false;
+  _gatePending = false;
+  _volumePending = false;
+
+  __enable_irq();
+
+  if (retune) {
+    _highPassFilter.setSampleRate(_sampleRate);
+    _voiceActivityDetector.setSampleRate(_sampleRate);
+    _noiseGate.setSampleRate(_sampleRate);
+    _graphicEqualiser.setSampleRate(_sampleRate);
+    _volumeControl.setSampleRate(_sampleRate);
+    _gainRamp.setSampleRate(_sampleRate);
+  }
+
+  if (restart) {
+    _gainRamp.reset();
+    _buttonMuted = _muteButton.isMuted();
+  }
+
+  if (highPassChanged) {
+    _highPassFilter.setSettings(highPass);
+  }
+
+  if (gateChanged) {
+    _noiseGate.setSettings(gate);
+  }
+
+  if (volumeChanged) {
+
+    _volumeControl.setVolume(volume);
+
+    if (volume != _volume) {
+#ifdef USE_NATIVE_SVC
+      _gainRamp.scale(powf(10, (_volume - volume) / 40.0f));
+#endif
+      _volume = volume;
+    }
+  }
 }
 
 /**
@@ -174,105 +486,256 @@ inline const GraphicEqualizer& Audio::getGraphicEqualizer() const {
 }
 
 /**
- * 1. Transform the I2S data into 16 bit PCM samples in a holding buffer
- * 2. Use the ST GREQ library to apply a graphic equaliser filter
- * 3. Use the ST SVC library to adjust the gain (volume)
- * 4. Transmit over USB to the host
+ * Change the high-pass filter's order and cutoff (called from the USB interrupt). The filter
+ * recalculates its coefficients in process() so they're applied at the next block.
+ */
+
+inline void Audio::setHighPass(const HighPassSettings &settings) {
+  _pendingHighPass = settings;
+  _highPassPending = true;
+}
+
+/**
+ * The high-pass filter settings, including any that are waiting for the next block
+ */
+
+inline HighPassSettings Audio::getHighPass() const {
+  return _highPassPending ? _pendingHighPass : _highPassFilter.getSettings();
+}
+
+/**
+ * Get a reference to the voice activity detector
+ */
+
+inline const VoiceActivityDetector& Audio::getVoiceActivityDetector() const {
+  return _voiceActivityDetector;
+}
+
+/**
+ * Change the noise gate settings (called from the USB interrupt). They're applied at the
+ * next block.
+ */
+
+inline void Audio::setNoiseGate(const NoiseGateSettings &settings) {
+  _pendingGate = settings;
+  _gatePending = true;
+}
+
+/**
+ * The noise gate settings, including any that are waiting for the next block
+ */
+
+inline const NoiseGateSettings& Audio::getNoiseGate() const {
+  return _gatePending ? _pendingGate : _noiseGate.getSettings();
+}
+
+/**
+ * Get a reference to the gain ramp that smooths mute and volume changes
+ */
+
+inline GainRamp& Audio::getGainRamp() {
+  return _gainRamp;
+}
+
+/**
+ * Get a reference to the dither used to requantise to the USB format
+ */
+
+inline Dither& Audio::getDither() {
+  return _dither;
+}
+
+/**
+ * Get a reference to the processing profiler
+ */
+
+inline Profiler& Audio::getProfiler() {
+  return _profiler;
+}
+
+/**
+ * 1. Transform the I2S data into Q31 mono samples in the process buffer
+ * 2. Remove the DC offset and sub-audio rumble with the high-pass filter and then listen
+ *    for speech with the voice activity detector
+ * 3. Attenuate the background noise between phrases with the noise gate, if it's enabled
+ * 4. Use the ST GREQ library to apply a graphic equaliser filter
+ * 5. Use the ST SVC library to adjust the gain (volume) and then ramp the gain smoothly
+ *    through any change of mute state or volume
+ * 6. Dither and requantise the Q31 samples to the host's format directly in the USB FIFO
+ * 7. Commit them to the FIFO for the USB interrupt to transmit to the host
  *
- * We've got 10ms to complete this method before the next DMA transfer will be ready.
+ * We've got MIC_MS_PER_PACKET/2 milliseconds to complete this method before the DMA starts
+ * to overwrite the block. The time taken by each stage is recorded by the profiler.
  */
 
-inline void Audio::sendData(volatile int32_t *data_in, int16_t *data_out) {
+inline void Audio::sendData(const int32_t *data_in, uint32_t blockFrame) {
 
   // only do anything at all if we're connected
 
   if (_running) {
 
-    // ensure that the mute state in the smart volume control library matches the mute
-    // state of the hardware button. we do this here to ensure that we only call SVC
-    // methods from inside an IRQ context.
+    _profiler.beginBlock();
+    applySettings();
 
-    if (_muteButton.isMuted()) {
-      if (!_volumeControl.isMuted()) {
-        _volumeControl.setMute(true);
+    // the gain ramp fades in and out of the mute state of the hardware button and the
+    // host. the SVC library's own mute isn't used because going into it makes a pop. The
+    // button's change starts on the frame that it was pressed on, which can be part way
+    // into the block.
 
-        // the next 50 frames (500ms) will be zero'd - this seems to do a better job of catching the
-        // mute button 'pop' than the SVC filter mute when going into a mute
+    uint16_t nSamples = _samplesPerPacket / 2;
+    uint16_t muteOffset = followMuteButton(blockFrame, nSamples);
 
-        _zeroCounter = 50;
-      }
-    }
-    else {
-      if (_volumeControl.isMuted()) {
+    // the output goes straight into space reserved in the USB FIFO. If the class driver
+    // won't take this block (the stream is starting or stopping, or the host has stopped
+    // reading) it's still processed, in the process buffer, so that the filters stay
+    // continuous and then it's dropped.
 
-        // coming out of a mute is handled well by the SVC filter
+    uint8_t subframeSize = _subframeSize;
+    uint8_t *data_out = USBD_AUDIO_Reserve_Transfer(&hUsbDeviceFS, nSamples);
+    bool dropped = data_out == nullptr;
 
-        _volumeControl.setMute(false);
-      }
+    if (dropped) {
+      data_out = reinterpret_cast<uint8_t*>(_processBuffer);
     }
 
-    if (_zeroCounter) {
-      memset(data_out, 0, (MIC_SAMPLES_PER_PACKET * sizeof(uint16_t)) / 2);
-      _zeroCounter--;
-    }
-    else {
+    // transform the I2S samples from the 64 bit L/R (32 bits per side) of which we
+    // only have data in the L side into Q31. The filters process the samples in place
+    // at this resolution. Q31 is also the 32 bit USB format so in that case the output
+    // buffer is used.
 
-      // transform the I2S samples from the 64 bit L/R (32 bits per side) of which we
-      // only have data in the L side. Take the most significant 16 bits, being careful
-      // to respect the sign bit.
+    int32_t *samples = subframeSize == 4 ? reinterpret_cast<int32_t*>(data_out) : _processBuffer;
 
-      int16_t *dest = _processBuffer;
+    I2sUnpack::toQ31(data_in, samples, nSamples);
 
-      for (uint16_t i = 0; i < MIC_SAMPLES_PER_PACKET / 2; i++) {
+    _profiler.endStage(Profiler::STAGE_CONVERSION);
 
-        // dither the LSB with a random bit
+    // the microphone's DC offset would otherwise be amplified by the gain stages
 
-        int16_t sample = (data_in[0] & 0xfffffffe) | (rand() & 1);
+    _highPassFilter.process(samples, nSamples);
+    _profiler.endStage(Profiler::STAGE_HIGHPASS);
 
-        *dest++ = sample;     // left channel has data
-        *dest++ = sample;     // right channel is duplicated from the left
-        data_in += 2;
-      }
+    _voiceActivityDetector.process(samples, nSamples);
+    _profiler.endStage(Profiler::STAGE_VAD);
+
+    // the gate is ahead of the gain stages so it doesn't have to track the volume, and
+    // ahead of the equalizer because nothing can go between that and the volume control.
+    // A disabled gate costs only this test.
 
-      // apply the graphic equaliser filters using the ST GREQ library then
-      // adjust the gain (volume) using the ST SVC library
+    if (_noiseGate.isEnabled()) {
+      _noiseGate.process(samples, nSamples, _voiceActivityDetector.isActive());
+      _profiler.endStage(Profiler::STAGE_GATE);
+    }
 
-      _graphicEqualiser.process(_processBuffer, MIC_SAMPLES_PER_PACKET / 2);
-      _volumeControl.process(_processBuffer, MIC_SAMPLES_PER_PACKET / 2);
+    // apply the graphic equaliser filters using the ST GREQ library then
+    // adjust the gain (volume) using the ST SVC library. The libraries only take
+    // 16 bit stereo so the block is passed between them converted in place (see
+    // StLibraryAdapter) and nothing can go in between them. The ramp is timed with
+    // the volume control that it follows.
 
-      // we only want the left channel from the processed buffer
+    _graphicEqualiser.process(samples, nSamples);
+    _profiler.endStage(Profiler::STAGE_EQUALIZER);
 
-      int16_t *src = _processBuffer;
-      dest = data_out;
+    _volumeControl.process(samples, nSamples);
 
-      for (uint16_t i = 0; i < MIC_SAMPLES_PER_PACKET / 2; i++) {
-        *dest++ = *src;
-        src += 2;
-      }
+    if (muteOffset) {
+      _gainRamp.process(samples, muteOffset);
     }
 
-    // send the adjusted data to the host
+    _gainRamp.setMuted(_buttonMuted || _hostMuted);
+    _gainRamp.process(samples + muteOffset, nSamples - muteOffset);
+    _profiler.endStage(Profiler::STAGE_VOLUME);
 
-    if (USBD_AUDIO_Data_Transfer(&hUsbDeviceFS, data_out, MIC_SAMPLES_PER_PACKET / 2) != USBD_OK) {
-      Error_Handler();
+    if (!dropped) {
+      _dither.requantise(samples, data_out, nSamples, subframeSize);
     }
+    _profiler.endStage(Profiler::STAGE_REQUANTISE);
+
+    // make the adjusted data available to the host
+
+    if (!dropped) {
+
+      if (USBD_AUDIO_Commit_Transfer(&hUsbDeviceFS, nSamples) != USBD_OK) {
+        Error_Handler();
+      }
+      _blocksSent++;
+    }
+
+    _profiler.endStage(Profiler::STAGE_USB);
+    _profiler.endBlock();
   }
 }
 
 /**
- * Override the I2S DMA half-complete HAL callback to process the first MIC_MS_PER_PACKET/2 milliseconds
- * of the data while the DMA device continues to run onward to fill the second half of the buffer.
+ * Override the I2S DMA half-complete HAL callback: the first MIC_MS_PER_PACKET/2 milliseconds
+ * of the buffer are ready while the DMA device continues to run onward to fill the second half
  */
 
 inline void Audio::i2s_halfComplete() {
-  sendData(_sampleBuffer, _sendBuffer);
+  blockReady(_sampleBuffer);
 }
 
 /**
- * Override the I2S DMA complete HAL callback to process the second MIC_MS_PER_PACKET/2 milliseconds
- * of the data while the DMA in circular mode wraps back to the start of the buffer
+ * Override the I2S DMA complete HAL callback: the second MIC_MS_PER_PACKET/2 milliseconds of the
+ * buffer are ready while the DMA in circular mode wraps back to the start of the buffer
  */
 
 inline void Audio::i2s_complete() {
-  sendData(&_sampleBuffer[MIC_SAMPLES_PER_PACKET], &_sendBuffer[MIC_SAMPLES_PER_PACKET / 2]);
+  blockReady(&_sampleBuffer[_samplesPerPacket]);
+}
+
+/**
+ * Publish a block to the processing stage. If the previous block hasn't been processed yet
+ * then the DMA is about to overwrite it and that's counted as an overrun. The block's first
+ * frame number goes with it and the count moves on to the block that the DMA is now filling.
+ */
+
+inline void Audio::blockReady(volatile int32_t *block) {
+
+  uint16_t nSamples = _samplesPerPacket / 2;
+
+  if (_blocksReady != _blocksDone) {
+    _profiler.countOverrun();
+  }
+
+  _readyBlock = block;
+  _readyFrame = _blockFrame;
+  _blockPosition = block == _sampleBuffer ? nSamples : 0;
+  _blockFrame = _readyFrame + nSamples;
+  __DMB();
+  _blocksReady++;
+
+  SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+}
+
+/**
+ * Process the most recently completed block (called from the PendSV handler). A block that
+ * was overtaken by the next one has already been counted as an overrun and is skipped.
+ */
+
+inline void Audio::processBlocks() {
+
+  uint32_t ready;
+  volatile int32_t *block;
+  uint32_t frame;
+
+  // the DMA interrupt can publish the next block between these reads. It always runs to
+  // completion before this resumes and moves the count on, so a snapshot taken with the
+  // same count on either side of it is a consistent one.
+
+  do {
+    ready = _blocksReady;
+    __DMB();
+    block = _readyBlock;
+    frame = _readyFrame;
+    __DMB();
+  } while (ready != _blocksReady);
+
+  if (ready != _blocksDone) {
+
+    // the DMA won't touch the block again until it's overtaken by the next one so it's
+    // read from here on as ordinary memory
+
+    sendData(const_cast<const int32_t*>(block), frame);
+    _blocksDone = ready;
+  }
 }
@@ -0,0 +1,243 @@
+/*
+ * This file is part of the firmware for the Andy's Workshop USB Microphone.
+ * Copyright 2021 Andy Brown. See https://andybrown.me.uk for project details.
+ * This project is open source subject to the license published on https://andybrown.me.uk.
+ */
+
+#pragma once
+
+#include <math.h>
+
+/**
+ * Native 10 band graphic equalizer built from a cascade of peaking biquad filters. The
+ * centre frequencies are the same as the ST GREQ library's 10 band mode.
+ *
+ * The filters are single precision transposed direct form II, the same structure as the
+ * CMSIS-DSP arm_biquad_cascade_df2T_f32 kernel, which suits the Cortex-M4 FPU's fused
+ * multiply-accumulate. The block is processed one band at a time and bands with 0dB gain
+ * are skipped entirely. Coefficients are only recalculated, on the next call to process(),
+ * for bands whose gain or sample rate has changed, and the filter state is carried across the
+ * change. A band that is switched to 0dB keeps running with its unity coefficients until what
+ * its old response left in the state has decayed, so that it doesn't stop with a step. Bands
+ * too close to the Nyquist frequency of the current sample rate are bypassed.
+ */
+
+class BiquadEqualizer {
+
+  public:
+    static const uint8_t NUM_BANDS = 10;
+
+  private:
+    struct Band {
+        float b0, b1, b2;     // feed-forward, normalised by a0
+        float a1, a2;         // feedback, normalised by a0
+        float z1, z2;         // state
+        int8_t gain;          // dB
+        uint32_t tail;        // samples that a band switched to 0dB keeps running for
+        bool inRange;         // centre frequency is below the Nyquist limit
+    };
+
+    Band _bands[NUM_BANDS];
+    uint16_t _dirty;          // bit mask of bands needing new coefficients
+    float _sampleRate;
+    float *_work;
+    uint16_t _maxSamples;
+
+  public:
+    BiquadEqualizer(float sampleRate, uint16_t maxSamples);
+
+    void setGain(uint8_t band, int8_t gain);
+    int8_t getGain(uint8_t band) const;
+    void setSampleRate(float sampleRate);
+
+    void process(int32_t *iobuffer, uint16_t nSamples);
+
+  private:
+    void updateCoefficients(uint8_t index);
+    void filter(Band &band, float *data, uint16_t nSamples);
+};
+
+/**
+ * Constructor
+ * @param sampleRate The sample rate in Hz
+ * @param maxSamples The largest block that will be passed to process()
+ */
+
+inline BiquadEqualizer::BiquadEqualizer(float sampleRate, uint16_t maxSamples) {
+
+  _sampleRate = sampleRate;
+  _maxSamples = maxSamples;
+  _work = new float[maxSamples];
+  _dirty = 0;
+
+  for (uint8_t i = 0; i < NUM_BANDS; i++) {
+
+    Band &band = _bands[i];
+
+    band.b0 = 1;
+    band.b1 = band.b2 = band.a1 = band.a2 = 0;
+    band.z1 = band.z2 = 0;
+    band.gain = 0;
+    band.tail = 0;
+    band.inRange = true;
+  }
+}
+
+/**
+ * Set the gain for a band. The coefficients are recalculated lazily.
+ * @param gain -12..12 dB
+ */
+
+inline void BiquadEqualizer::setGain(uint8_t band, int8_t gain) {
+
+  if (band < NUM_BANDS && _bands[band].gain != gain) {
+    _bands[band].gain = gain;
+    _dirty |= 1 << band;
+  }
+}
+
+inline int8_t BiquadEqualizer::getGain(uint8_t band) const {
+  return _bands[band].gain;
+}
+
+/**
+ * Change the sample rate. All the coefficients are recalculated and the filter state is
+ * cleared on the next call to process().
+ */
+
+inline void BiquadEqualizer::setSampleRate(float sampleRate) {
+
+  _sampleRate = sampleRate;
+  _dirty = (1 << NUM_BANDS) - 1;
+
+  for (uint8_t i = 0; i < NUM_BANDS; i++) {
+    _bands[i].z1 = _bands[i].z2 = 0;
+  }
+}
+
+/**
+ * RBJ audio EQ cookbook peaking filter. The Q gives constant-Q bands that meet at roughly
+ * their -3dB points given the ~0.9 octave spacing of the centre frequencies.
+ */
+
+inline void BiquadEqualizer::updateCoefficients(uint8_t index) {
+
+  static const float centreFrequencies[NUM_BANDS] = { 62, 115, 214, 399, 742, 1380, 2567, 4775, 8882, 16520 };
+  static const float q = 1.6f;
+
+  Band &band = _bands[index];
+
+  // the peak is too distorted by the bilinear transform to be useful near Nyquist
+
+  band.inRange = centreFrequencies[index] < 0.45f * _sampleRate;
+
+  float A = powf(10, band.gain / 40.0f);
+  float w0 = 2 * (float) M_PI * centreFrequencies[index] / _sampleRate;
+  float cosw0 = cosf(w0);
+  float alpha = sinf(w0) / (2 * q);
+  float a0 = 1 + alpha / A;
+
+  band.b0 = (1 + alpha * A) / a0;
+  band.b1 = (-2 * cosw0) / a0;
+  band.b2 = (1 - alpha * A) / a0;
+  band.a1 = (-2 * cosw0) / a0;
+  band.a2 = (1 - alpha / A) / a0;
+
+  // at 0dB the zeros cancel the poles and the state decays at the pole radius, sqrt(a2). Run
+  // the band until it's down by 2^-28, below the LSB of a full scale signal boosted by 12dB.
+
+  if (band.gain != 0 || (band.z1 == 0 && band.z2 == 0)) {
+    band.tail = 0;
+  } else {
+    band.tail = (uint32_t) (-2 * 28 * (float) M_LN2 / logf(band.a2)) + 1;
+  }
+}
+
+/**
+ * Run one band over the block
+ */
+
+inline void BiquadEqualizer::filter(Band &band, float *data, uint16_t nSamples) {
+
+  const float b0 = band.b0, b1 = band.b1, b2 = band.b2;
+  const float a1 = band.a1, a2 = band.a2;
+  float z1 = band.z1, z2 = band.z2;
+
+  for (uint16_t i = 0; i < nSamples; i++) {
+
+    float x = data[i];
+    float y = b0 * x + z1;
+
+    z1 = b1 * x - a1 * y + z2;
+    z2 = b2 * x - a2 * y;
+
+    data[i] = y;
+  }
+
+  band.z1 = z1;
+  band.z2 = z2;
+}
+
+/**
+ * Process a block of mono Q31 samples in place. The filters work in 24 bit units, which is
+ * both the resolution of the microphone and the precision of a single precision float.
+ */
+
+inline void BiquadEqualizer::process(int32_t *iobuffer, uint16_t nSamples) {
+
+  // recalculate any bands that have changed since the last block
+
+  while (_dirty) {
+
+    uint8_t index = __builtin_ctz(_dirty);
+
+    updateCoefficients(index);
+    _dirty &= ~(1 << index);
+  }
+
+  if (nSamples > _maxSamples) {
+    nSamples = _maxSamples;
+  }
+
+  // convert to float, filter through each active band and convert back with saturation
+
+  bool active = false;
+
+  for (uint8_t i = 0; i < NUM_BANDS; i++) {
+
+    Band &band = _bands[i];
+
+    if ((band.gain != 0 || band.tail) && band.inRange) {
+
+      if (!active) {
+        for (uint16_t j = 0; j < nSamples; j++) {
+          _work[j] = iobuffer[j] >> 8;
+        }
+        active = true;
+      }
+
+      filter(band, _work, nSamples);
+
+      // a band that has finished decaying is off and starts from silence when it's switched on
+
+      if (band.gain == 0) {
+        if (band.tail > nSamples) {
+          band.tail -= nSamples;
+        } else {
+          band.tail = 0;
+          band.z1 = band.z2 = 0;
+        }
+      }
+    }
+  }
+
+  if (active) {
+    for (uint16_t j = 0; j < nSamples; j++) {
+
+      float y = _work[j];
+      int32_t sample = __SSAT((int32_t) (y + (y < 0 ? -0.5f : 0.5f)), 24);
+
+      iobuffer[j] = (int32_t) ((uint32_t) sample << 8);
+    }
+  }
+}
@@ -7,7 +7,14 @@
 #pragma once
 
 /**
- * A debounced button class
+ * An interrupt driven, debounced button. The pin's EXTI line interrupts on both edges. The
+ * first edge is timestamped, the line is masked and a one-shot hardware timer is started. When
+ * the timer expires the pin is read again and, if it has settled in the other state, an event
+ * carrying the time of the first edge is posted for the main loop. Nothing is polled so the
+ * main loop can sleep until there's something to do.
+ *
+ * The EXTI and timer interrupts must have the same priority so that they can't preempt each
+ * other. The timer counts at 10kHz in one-pulse mode (see MX_TIM7_Init).
  */
 
 class Button: public GpioPin {
@@ -19,89 +26,106 @@ class Button: public GpioPin {
       Down
     };
 
+    struct Event {
+      CurrentState state;
+      uint32_t timestamp;           // as passed to edge()
+    };
+
   private:
 
     static const uint32_t DEBOUNCE_UP_DELAY_MILLIS = 100;
     static const uint32_t DEBOUNCE_DOWN_DELAY_MILLIS = 1;
+    static const uint32_t TIMER_TICKS_PER_MILLI = 10;
 
-    enum InternalState {
-      Idle,                         // nothing happening
-      DebounceUpDelay,              // delaying...
-      DebounceDownDelay
-    };
-
+    TIM_TypeDef *_timer;            // the debounce timer
     bool _pressedIsHigh;            // The button is electrically HIGH when pressed?
-    InternalState _internalState;   // Internal state of the class
-
-    bool _lastButtonReading;        // the last state we sampled
-    uint32_t _transitionTime;       // the time of the last transition
+    bool _pressed;                  // the debounced state
+    bool _debouncing;               // waiting for the timer
+    uint32_t _edgeTime;             // the time of the first edge
+    EventQueue<Event, 8> _events;
 
   public:
-    Button(const GpioPin &pin, bool pressedIsHigh);
-    CurrentState getAndClearCurrentState();   // retrieve current state and reset to idle
+    Button(const GpioPin &pin, bool pressedIsHigh, TIM_TypeDef *timer);
+
+    void edge(uint32_t timestamp);
+    void debounced();
+
+    bool getEvent(Event &event);
+    bool hasEvents() const;
+
+  private:
+    bool isPressed() const;
 };
 
-inline Button::Button(const GpioPin &pin, bool pressedIsHigh) :
+inline Button::Button(const GpioPin &pin, bool pressedIsHigh, TIM_TypeDef *timer) :
     GpioPin(pin) {
 
-  _transitionTime = 0;
-  _lastButtonReading = false;
+  _timer = timer;
   _pressedIsHigh = pressedIsHigh;
-  _internalState = Idle;
+  _pressed = isPressed();
+  _debouncing = false;
+  _edgeTime = 0;
 }
 
 /**
- * Get and reset the current state. This should be called in the main application loop.
- * @return The current state. If the current state is one of the up/down pressed states
- * then that state is returned and then internally reset to none so the application only
- * gets one 'notification' that the button is pressed/released.
+ * Read the pin and flip it if this switch reads high when open
  */
 
-inline Button::CurrentState Button::getAndClearCurrentState() {
+inline bool Button::isPressed() const {
+  return getState() == _pressedIsHigh;
+}
+
+/**
+ * An edge on the pin (called from the EXTI interrupt). The line stays masked while the contacts
+ * bounce. The debounced state is the opposite of the one the edge leaves, so its delay is used.
+ */
 
-  // read the pin and flip it if this switch reads high when open
+inline void Button::edge(uint32_t timestamp) {
 
-  bool buttonReading = getState();
-  if (!_pressedIsHigh) {
-    buttonReading ^= true;
+  if (_debouncing) {
+    return;
   }
 
-  const uint32_t now = HAL_GetTick();
+  _debouncing = true;
+  _edgeTime = timestamp;
 
-  if (_lastButtonReading == buttonReading) {
+  EXTI->IMR &= ~(uint32_t) getPin();
 
-    // no change in the button reading, we could be exiting the debounce delay
+  _timer->ARR = (_pressed ? DEBOUNCE_UP_DELAY_MILLIS : DEBOUNCE_DOWN_DELAY_MILLIS) * TIMER_TICKS_PER_MILLI - 1;
+  _timer->CNT = 0;
+  _timer->CR1 |= TIM_CR1_CEN;
+}
 
-    switch (_internalState) {
+/**
+ * The debounce delay has expired (called from the timer interrupt). The pending edges are
+ * cleared before the pin is read so that an edge after the read interrupts again when the
+ * line is unmasked. A bounce that settles back where it started doesn't post anything.
+ */
 
-    case DebounceUpDelay:
-      if (now - _transitionTime > DEBOUNCE_UP_DELAY_MILLIS) {
-        _internalState = Idle;
-        return Up;
-      }
-      break;
+inline void Button::debounced() {
 
-    case DebounceDownDelay:
-      if (now - _transitionTime > DEBOUNCE_DOWN_DELAY_MILLIS) {
-        _internalState = Idle;
-        return Down;
-      }
-      break;
+  EXTI->PR = getPin();
 
-    case Idle:
-      break;
-    }
+  bool pressed = isPressed();
 
-    return None;
+  if (pressed != _pressed) {
+    _pressed = pressed;
+    _events.post( { pressed ? Down : Up, _edgeTime });
+  }
 
-  } else {
+  _debouncing = false;
+  EXTI->IMR |= getPin();
+}
 
-    // button reading has changed, this always causes the state to enter the debounce delay
+/**
+ * Get the next press or release (called from the main loop)
+ * @return false if there isn't one
+ */
 
-    _transitionTime = now;
-    _lastButtonReading = buttonReading;
-    _internalState = buttonReading ? DebounceDownDelay : DebounceUpDelay;
+inline bool Button::getEvent(Event &event) {
+  return _events.get(event);
+}
 
-    return None;
-  }
+inline bool Button::hasEvents() const {
+  return !_events.isEmpty();
 }
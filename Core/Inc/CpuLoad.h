@@ -0,0 +1,109 @@
+/*
+ * This file is part of the firmware for the Andy's Workshop USB Microphone.
+ * Copyright 2021 Andy Brown. See https://andybrown.me.uk for project details.
+ * This project is open source subject to the license published on https://andybrown.me.uk.
+ */
+
+#pragma once
+
+/**
+ * Measures the share of the time that the core is awake. The main loop sleeps through
+ * sleep() and the time spent asleep is counted with SysTick, which carries on counting while
+ * the core is stopped. Every second the busy share of that second is calculated. The window
+ * is restarted when the clock speed changes because that changes the length of a SysTick
+ * period.
+ */
+
+class CpuLoad {
+
+  private:
+    static const uint32_t WINDOW_MILLIS = 1000;
+
+    uint32_t _windowStart;        // ms
+    uint64_t _idle;               // SysTick counts asleep in this window
+    volatile uint16_t _load;      // busy time in the last window in 0.1%
+
+  public:
+    CpuLoad();
+
+    void sleep();
+    void update();
+    void restart();
+
+    uint16_t getLoad() const;
+};
+
+/**
+ * Constructor
+ */
+
+inline CpuLoad::CpuLoad() {
+  _load = 0;
+  restart();
+}
+
+/**
+ * Start a new window
+ */
+
+inline void CpuLoad::restart() {
+  _windowStart = HAL_GetTick();
+  _idle = 0;
+}
+
+/**
+ * Sleep until the next interrupt and count the time as idle. This must be called with
+ * interrupts masked so that the one that wakes the core doesn't run until the time has been
+ * read. SysTick wakes the core at least once a millisecond so it can only have wrapped once,
+ * and its count flag says whether it did. The flag is cleared by reading it so a wrap between
+ * reading the flag and the count is caught by reading the count again.
+ */
+
+inline void CpuLoad::sleep() {
+
+  (void) SysTick->CTRL;
+  uint32_t before = SysTick->VAL;
+
+  if (SysTick->CTRL & SysTick_CTRL_COUNTFLAG_Msk) {
+    before = SysTick->VAL;
+  }
+
+  __WFI();
+
+  uint32_t after = SysTick->VAL;
+  uint32_t idle = before - after;
+
+  // SysTick counts down
+
+  if (SysTick->CTRL & SysTick_CTRL_COUNTFLAG_Msk) {
+    after = SysTick->VAL;
+    idle = before + SysTick->LOAD + 1 - after;
+  }
+
+  _idle += idle;
+}
+
+/**
+ * Close the window if it has run its length (called from the main loop)
+ */
+
+inline void CpuLoad::update() {
+
+  uint32_t elapsed = HAL_GetTick() - _windowStart;
+
+  if (elapsed >= WINDOW_MILLIS) {
+
+    uint64_t total = (uint64_t) elapsed * (SysTick->LOAD + 1);
+
+    _load = _idle < total ? (total - _idle) * 1000 / total : 0;
+    restart();
+  }
+}
+
+/**
+ * The busy share of the last complete second in 0.1%
+ */
+
+inline uint16_t CpuLoad::getLoad() const {
+  return _load;
+}
@@ -0,0 +1,214 @@
+/*
+ * This file is part of the firmware for the Andy's Workshop USB Microphone.
+ * Copyright 2021 Andy Brown. See https://andybrown.me.uk for project details.
+ * This project is open source subject to the license published on https://andybrown.me.uk.
+ */
+
+#pragma once
+
+/**
+ * Requantisation of the Q31 samples to the 16 or 24 bit USB subframe formats with dither.
+ * The noise comes from an inline xorshift generator, one 32 bit word per sample, and is added
+ * at the final reduction in resolution. Three modes are available:
+ *
+ *   RECTANGULAR   one output LSB of uniform noise. Cheapest, but the noise level still
+ *                 depends on the signal.
+ *   TRIANGULAR    the sum of two uniform values, +/-1 LSB. The noise floor is constant
+ *                 whatever the signal. This is the default.
+ *   NOISE_SHAPED  triangular dither with first-order error feedback. The total noise is
+ *                 higher but it's pushed up towards half the sample rate and out of the
+ *                 lower part of the band.
+ *
+ * 32 bit output is the Q31 samples themselves so nothing is done to it.
+ */
+
+class Dither {
+
+  public:
+    enum Mode {
+      RECTANGULAR,
+      TRIANGULAR,
+      NOISE_SHAPED
+    };
+
+  private:
+    Mode _mode;
+    uint32_t _state;
+    int32_t _error;       // Q31 quantisation error carried to the next sample when noise shaping
+
+  public:
+    Dither();
+
+    void setMode(Mode mode);
+    Mode getMode() const;
+    void seed(uint32_t seed);
+
+    void requantise(const int32_t *samples, uint8_t *data_out, uint16_t nSamples, uint8_t subframeSize);
+
+    static const char* getModeName(Mode mode);
+
+  private:
+    uint32_t next();
+
+    template<Mode mode, uint8_t shift>
+    int32_t quantise(int32_t sample);
+
+    template<Mode mode>
+    void requantise16(const int32_t *samples, uint8_t *data_out, uint16_t nSamples);
+
+    template<Mode mode>
+    void requantise24(const int32_t *samples, uint8_t *data_out, uint16_t nSamples);
+};
+
+/**
+ * Constructor
+ */
+
+inline Dither::Dither() {
+  _mode = TRIANGULAR;
+  _error = 0;
+  seed(1);
+}
+
+/**
+ * Select the dither. The noise shaping error is cleared.
+ */
+
+inline void Dither::setMode(Mode mode) {
+  _mode = mode;
+  _error = 0;
+}
+
+inline Dither::Mode Dither::getMode() const {
+  return _mode;
+}
+
+/**
+ * Restart the generator. Zero is the one state that xorshift can't leave.
+ */
+
+inline void Dither::seed(uint32_t seed) {
+  _state = seed ? seed : 1;
+}
+
+/**
+ * xorshift32: three shifts and three XORs, no branches and no multiplies
+ */
+
+inline uint32_t Dither::next() {
+
+  uint32_t x = _state;
+
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+
+  return _state = x;
+}
+
+/**
+ * Reduce one Q31 sample by 'shift' bits. The arithmetic shift truncates towards minus infinity
+ * so the triangular noise, which is centred on zero, has half an LSB added to round instead.
+ * The rectangular noise is all positive so it rounds already. The saturating add can't wrap
+ * at full scale.
+ */
+
+template<Dither::Mode mode, uint8_t shift>
+inline int32_t Dither::quantise(int32_t sample) {
+
+  const uint32_t mask = (1U << shift) - 1;
+  uint32_t r = next();
+
+  if (mode == RECTANGULAR) {
+    return __QADD(sample, r & mask) >> shift;
+  }
+
+  int32_t noise = (int32_t) ((r & mask) + ((r >> 16) & mask)) - (int32_t) (1U << (shift - 1));
+
+  if (mode == TRIANGULAR) {
+    return __QADD(sample, noise) >> shift;
+  }
+
+  // first-order error feedback: the output is the input plus the difference of successive
+  // errors, i.e. the requantisation noise filtered by 1 - z^-1
+
+  int32_t wanted = __QADD(sample, -_error);
+  int32_t output = __QADD(wanted, noise) >> shift;
+
+  _error = (int32_t) (((uint32_t) output << shift) - (uint32_t) wanted);
+  return output;
+}
+
+template<Dither::Mode mode>
+inline void Dither::requantise16(const int32_t *samples, uint8_t *data_out, uint16_t nSamples) {
+
+  int16_t *dest = reinterpret_cast<int16_t*>(data_out);
+
+  for (uint16_t i = 0; i < nSamples; i++) {
+    *dest++ = quantise<mode, 16>(*samples++);
+  }
+}
+
+/**
+ * Packed little-endian 24 bit
+ */
+
+template<Dither::Mode mode>
+inline void Dither::requantise24(const int32_t *samples, uint8_t *data_out, uint16_t nSamples) {
+
+  for (uint16_t i = 0; i < nSamples; i++) {
+
+    int32_t sample = quantise<mode, 8>(*samples++);
+
+    *data_out++ = sample;
+    *data_out++ = sample >> 8;
+    *data_out++ = sample >> 16;
+  }
+}
+
+/**
+ * Requantise a block to the subframe size. The mode is resolved once per block so that the
+ * per-sample loop has no branches.
+ */
+
+inline void Dither::requantise(const int32_t *samples, uint8_t *data_out, uint16_t nSamples, uint8_t subframeSize) {
+
+  if (subframeSize == 2) {
+
+    switch (_mode) {
+      case RECTANGULAR:
+        requantise16<RECTANGULAR>(samples, data_out, nSamples);
+        break;
+      case TRIANGULAR:
+        requantise16<TRIANGULAR>(samples, data_out, nSamples);
+        break;
+      case NOISE_SHAPED:
+        requantise16<NOISE_SHAPED>(samples, data_out, nSamples);
+        break;
+    }
+  }
+  else if (subframeSize == 3) {
+
+    switch (_mode) {
+      case RECTANGULAR:
+        requantise24<RECTANGULAR>(samples, data_out, nSamples);
+        break;
+      case TRIANGULAR:
+        requantise24<TRIANGULAR>(samples, data_out, nSamples);
+        break;
+      case NOISE_SHAPED:
+        requantise24<NOISE_SHAPED>(samples, data_out, nSamples);
+        break;
+    }
+  }
+}
+
+/**
+ * A short name for printing
+ */
+
+inline const char* Dither::getModeName(Mode mode) {
+
+  static const char *names[] = { "rectangular", "triangular", "shaped" };
+  return names[mode];
+}
@@ -0,0 +1,91 @@
+/*
+ * This file is part of the firmware for the Andy's Workshop USB Microphone.
+ * Copyright 2021 Andy Brown. See https://andybrown.me.uk for project details.
+ * This project is open source subject to the license published on https://andybrown.me.uk.
+ */
+
+#pragma once
+
+/**
+ * Fixed size queue of events from one interrupt handler to the main loop. The producer only
+ * writes the head and the consumer only writes the tail so neither needs to disable
+ * interrupts. The size must be a power of two and one slot is always left empty. An event
+ * posted to a full queue is dropped.
+ */
+
+template<class T, uint8_t TSize>
+class EventQueue {
+
+  private:
+    T _events[TSize];
+    volatile uint8_t _head;       // next slot to post to
+    volatile uint8_t _tail;       // next slot to get from
+
+  public:
+    EventQueue();
+
+    bool post(const T &event);
+    bool get(T &event);
+    bool isEmpty() const;
+};
+
+/**
+ * Constructor
+ */
+
+template<class T, uint8_t TSize>
+inline EventQueue<T, TSize>::EventQueue() {
+  static_assert((TSize & (TSize - 1)) == 0, "the queue size must be a power of two");
+  _head = _tail = 0;
+}
+
+/**
+ * Add an event (called from the producing interrupt)
+ * @return false if the queue was full and the event has been dropped
+ */
+
+template<class T, uint8_t TSize>
+inline bool EventQueue<T, TSize>::post(const T &event) {
+
+  uint8_t head = _head;
+  uint8_t next = (head + 1) & (TSize - 1);
+
+  if (next == _tail) {
+    return false;
+  }
+
+  // the event must be in memory before the consumer can see the new head
+
+  _events[head] = event;
+  __DMB();
+  _head = next;
+
+  return true;
+}
+
+/**
+ * Remove the oldest event (called from the main loop)
+ * @return false if the queue was empty
+ */
+
+template<class T, uint8_t TSize>
+inline bool EventQueue<T, TSize>::get(T &event) {
+
+  uint8_t tail = _tail;
+
+  if (tail == _head) {
+    return false;
+  }
+
+  __DMB();
+  event = _events[tail];
+  __DMB();
+  _tail = (tail + 1) & (TSize - 1);
+
+  return true;
+}
+
+template<class T, uint8_t TSize>
+inline bool EventQueue<T, TSize>::isEmpty() const {
+  return _head == _tail;
+}
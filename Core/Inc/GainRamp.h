@@ -0,0 +1,185 @@
+/*
+ * This file is part of the firmware for the Andy's Workshop USB Microphone.
+ * Copyright 2021 Andy Brown. See https://andybrown.me.uk for project details.
+ * This project is open source subject to the license published on https://andybrown.me.uk.
+ */
+
+#pragma once
+
+/**
+ * Per-sample gain ramp at the output of the volume control. Every change of level that would
+ * otherwise be a step in the signal is spread over the fade time instead:
+ *
+ *   - muting ramps down to silence and unmuting ramps back up to unity
+ *   - the stream starts from silence and ramps up
+ *   - a volume change is applied to the native volume limiter at once and scale() is given
+ *     the ratio of the old gain to the new one. The ramp starts from that ratio so the output
+ *     level is unchanged at first and then moves to the new level over the fade time. The ST
+ *     SVC library smooths its own volume changes so scale() isn't used with it.
+ *
+ * The ramp is linear in amplitude. The gain is Q24 so that the compensation for a volume
+ * reduction of up to 42dB can be carried. Larger reductions are partly stepped. At unity
+ * the block is left untouched and when fully muted it's cleared, so the per-sample multiply
+ * is only paid while a ramp is in progress.
+ */
+
+class GainRamp {
+
+  public:
+    static const int32_t UNITY_GAIN = 1 << 24;
+
+  private:
+    uint32_t _sampleRate;
+    uint16_t _fadeTime;       // ms
+    uint32_t _fadeSamples;
+
+    int32_t _gain;            // Q24
+    int32_t _target;          // Q24, zero or unity
+    int32_t _step;            // added per sample until the target is reached
+
+  public:
+    GainRamp(uint32_t sampleRate);
+
+    void setFadeTime(uint16_t ms);
+    uint16_t getFadeTime() const;
+    void setSampleRate(uint32_t sampleRate);
+
+    void setMuted(bool muted);
+    void scale(float ratio);
+    void reset();
+
+    void process(int32_t *iobuffer, uint16_t nSamples);
+
+  private:
+    void updateStep();
+};
+
+/**
+ * Constructor: a 5ms fade that starts from silence
+ */
+
+inline GainRamp::GainRamp(uint32_t sampleRate) {
+  _fadeTime = 5;
+  _target = UNITY_GAIN;
+  setSampleRate(sampleRate);
+  reset();
+}
+
+/**
+ * Set the time taken by a full-scale ramp, e.g. from unity to silence
+ */
+
+inline void GainRamp::setFadeTime(uint16_t ms) {
+  _fadeTime = ms;
+  setSampleRate(_sampleRate);
+}
+
+inline uint16_t GainRamp::getFadeTime() const {
+  return _fadeTime;
+}
+
+inline void GainRamp::setSampleRate(uint32_t sampleRate) {
+
+  _sampleRate = sampleRate;
+  _fadeSamples = _fadeTime * sampleRate / 1000;
+
+  if (_fadeSamples == 0) {
+    _fadeSamples = 1;
+  }
+  updateStep();
+}
+
+/**
+ * Ramp towards silence or back up to unity
+ */
+
+inline void GainRamp::setMuted(bool muted) {
+
+  int32_t target = muted ? 0 : UNITY_GAIN;
+
+  if (target != _target) {
+    _target = target;
+    updateStep();
+  }
+}
+
+/**
+ * Multiply the current gain by a ratio and ramp back to the target from there
+ */
+
+inline void GainRamp::scale(float ratio) {
+
+  float gain = _gain * ratio;
+
+  _gain = gain >= (float) INT32_MAX ? INT32_MAX : (int32_t) gain;
+  updateStep();
+}
+
+/**
+ * Drop to silence so that the next block fades in, as at the start of a stream
+ */
+
+inline void GainRamp::reset() {
+  _gain = 0;
+  updateStep();
+}
+
+/**
+ * The ramp moves at the full-scale rate, so a partial ramp takes proportionally less time.
+ * From above unity it moves faster so that it still finishes within the fade time.
+ */
+
+inline void GainRamp::updateStep() {
+
+  int32_t range = _gain > UNITY_GAIN ? _gain : UNITY_GAIN;
+
+  _step = (int32_t) (((int64_t) range + _fadeSamples - 1) / _fadeSamples);
+
+  if (_target < _gain) {
+    _step = -_step;
+  }
+}
+
+/**
+ * Process a block of mono Q31 samples in place
+ */
+
+inline void GainRamp::process(int32_t *iobuffer, uint16_t nSamples) {
+
+  int32_t gain = _gain;
+  const int32_t target = _target;
+
+  if (gain == target) {
+
+    if (gain == 0) {
+      memset(iobuffer, 0, nSamples * sizeof(int32_t));
+    }
+    return;
+  }
+
+  const int32_t step = _step;
+
+  for (uint16_t i = 0; i < nSamples; i++) {
+
+    if (gain != target) {
+      gain += step;
+
+      if (step > 0 ? gain > target : gain < target) {
+        gain = target;
+      }
+    }
+
+    int64_t output = ((int64_t) iobuffer[i] * gain) >> 24;
+
+    if (output > INT32_MAX) {
+      output = INT32_MAX;
+    }
+    else if (output < INT32_MIN) {
+      output = INT32_MIN;
+    }
+
+    iobuffer[i] = (int32_t) output;
+  }
+
+  _gain = gain;
+}
@@ -23,6 +23,7 @@ class GpioPin {
     void reset() const;
     void setState(bool state) const;
     bool getState() const;
+    uint16_t getPin() const;
 
     GpioPin& operator=(const GpioPin &src);
 };
@@ -48,6 +49,10 @@ inline bool GpioPin::getState() const {
   return HAL_GPIO_ReadPin(_port, _pin) == GPIO_PIN_SET;
 }
 
+inline uint16_t GpioPin::getPin() const {
+  return _pin;
+}
+
 inline void GpioPin::setState(bool state) const {
   HAL_GPIO_WritePin(_port, _pin, state ? GPIO_PIN_SET : GPIO_PIN_RESET);
 }
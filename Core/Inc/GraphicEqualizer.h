@@ -9,27 +9,40 @@
 /**
  * Service class to manage the API to the ST GREQ library. This is provided as a closed source
  * but free-to-use library by ST Micro. See UM1798 for details.
+ *
+ * If USE_NATIVE_GREQ is defined then the in-tree BiquadEqualizer is used instead of the library.
+ * The band layout and the public API are the same for both engines.
+ *
+ * Band gains can be changed by the USB interrupt while a block is being processed. setBand()
+ * only records the new gain and the engine is reconfigured at the start of the next call to
+ * process(), so the library is never reconfigured part way through a block.
  */
 
 class GraphicEqualizer {
 
   private:
+#ifdef USE_NATIVE_GREQ
+    BiquadEqualizer _engine;
+#else
     uint8_t *_greqPersistent;
     uint8_t *_greqScratch;
 
     buffer_t _greqInput;
     buffer_t _greqOutput;
+#endif
 
     // the range of the 10 bands is -12..+12 in 1dB steps
     greq_dynamic_param_t _dynamicParam;
+    volatile bool _dirty;
 
   public:
     GraphicEqualizer();
 
     void setBand(int8_t index, int8_t value);
     const int16_t* getGainsPerBand() const;
+    void setSampleRate(uint32_t sampleRate);
 
-    void process(int16_t *iobuffer, int32_t nSamples);
+    void process(int32_t *iobuffer, int32_t nSamples);
 };
 
 /**
@@ -40,12 +53,19 @@ extern "C" {
 extern greq_dynamic_param_t *pEqualizerParams;
 }
 
+#ifdef USE_NATIVE_GREQ
+inline GraphicEqualizer::GraphicEqualizer()
+    : _engine(MIC_SAMPLE_FREQUENCY, MIC_MAX_SAMPLES_PER_PACKET / 2) {
+#else
 inline GraphicEqualizer::GraphicEqualizer() {
+#endif
 
   // the USB 'C' interface needs access to this
 
   pEqualizerParams = &_dynamicParam;
 
+#ifndef USE_NATIVE_GREQ
+
   // allocate space required by the SVC library
 
   _greqPersistent = new uint8_t[greq_persistent_mem_size];  // 548
@@ -67,11 +87,12 @@ inline GraphicEqualizer::GraphicEqualizer() {
     Error_Handler();
   }
 
-  // buffer constants
+  // buffer constants. The library only accepts 16 bit stereo so the adapter converts to it.
 
   _greqInput.nb_channels = _greqOutput.nb_channels = 2;
-  _greqInput.nb_bytes_per_Sample = _greqOutput.nb_bytes_per_Sample = 2;
+  _greqInput.nb_bytes_per_Sample = _greqOutput.nb_bytes_per_Sample = 2;    // 16 bit only
   _greqInput.mode = _greqOutput.mode = INTERLEAVED;
+#endif
 
   // set the bands
 
@@ -88,7 +109,7 @@ inline GraphicEqualizer::GraphicEqualizer() {
   _dynamicParam.user_gain_per_band_dB[9] = 3;   // 16520
   _dynamicParam.gain_preset_idx = 0;
 
-  greq_setConfig(&_dynamicParam, _greqPersistent);
+  _dirty = true;
 }
 
 /**
@@ -100,31 +121,70 @@ inline const int16_t* GraphicEqualizer::getGainsPerBand() const {
 }
 
 /**
- * Update the value of a band
+ * Update the value of a band. It takes effect from the next block.
  */
 
 inline void GraphicEqualizer::setBand(int8_t index, int8_t value) {
   _dynamicParam.user_gain_per_band_dB[index] = value;
-  greq_setConfig(&_dynamicParam, _greqPersistent);
+  _dirty = true;
 }
 
 /**
- * Process a sample buffer
+ * Set the sample rate. The GREQ library has no sample rate parameter and its band centres are
+ * designed for 48kHz, so they shift in proportion at other rates.
  */
 
-inline void GraphicEqualizer::process(int16_t *iobuffer, int32_t nSamples) {
+inline void GraphicEqualizer::setSampleRate(uint32_t sampleRate) {
+#ifdef USE_NATIVE_GREQ
+  _engine.setSampleRate(sampleRate);
+#endif
+}
 
-  // initialise the buffer parameters
+/**
+ * Process a block of mono Q31 samples in place. The ST library leaves the block as 16 bit
+ * stereo for the SVC library, or takes it back to Q31 itself if the native volume control is
+ * in use.
+ */
 
-  _greqInput.buffer_size = _greqOutput.buffer_size = nSamples;
+inline void GraphicEqualizer::process(int32_t *iobuffer, int32_t nSamples) {
 
-  _greqInput.data_ptr = iobuffer;
-  _greqOutput.data_ptr = iobuffer;
+  // the flag is cleared first so that a gain that changes while the engine is being
+  // reconfigured is picked up by the next block
 
-  // call the library method
+  if (_dirty) {
+    _dirty = false;
 
-  int32_t error = greq_process(&_greqInput, &_greqOutput, _greqPersistent);
-  if (error != GREQ_ERROR_NONE) {
-    Error_Handler();
+#ifdef USE_NATIVE_GREQ
+    for (uint8_t i = 0; i < BiquadEqualizer::NUM_BANDS; i++) {
+      _engine.setGain(i, _dynamicParam.user_gain_per_band_dB[i]);
+    }
+#else
+    greq_setConfig(&_dynamicParam, _greqPersistent);
+#endif
   }
+
+#ifdef USE_NATIVE_GREQ
+  _engine.process(iobuffer, nSamples);
+#else
+  StLibraryAdapter::toStereo(iobuffer, nSamples);
+
+  for (int32_t offset = 0; offset < nSamples; offset += StLibraryAdapter::CHUNK_FRAMES) {
+
+    uint16_t nFrames = nSamples - offset < StLibraryAdapter::CHUNK_FRAMES ? nSamples - offset : StLibraryAdapter::CHUNK_FRAMES;
+
+    _greqInput.data_ptr = _greqOutput.data_ptr = iobuffer + offset;
+    _greqInput.buffer_size = _greqOutput.buffer_size = nFrames;
+
+    // call the library method
+
+    int32_t error = greq_process(&_greqInput, &_greqOutput, _greqPersistent);
+    if (error != GREQ_ERROR_NONE) {
+      Error_Handler();
+    }
+  }
+
+#ifdef USE_NATIVE_SVC
+  StLibraryAdapter::toMono(iobuffer, nSamples);
+#endif
+#endif
 }
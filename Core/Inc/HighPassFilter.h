@@ -0,0 +1,266 @@
+/*
+ * This file is part of the firmware for the Andy's Workshop USB Microphone.
+ * Copyright 2021 Andy Brown. See https://andybrown.me.uk for project details.
+ * This project is open source subject to the license published on https://andybrown.me.uk.
+ */
+
+#pragma once
+
+#include <math.h>
+
+/**
+ * The high-pass filter parameters as exchanged with the host by the MIC_VENDOR_REQ_HIGHPASS
+ * vendor request. All values are little-endian.
+ */
+
+struct HighPassSettings {
+    uint8_t order;              // 0 for off, 1 or 2
+    uint8_t reserved;
+    uint16_t cutoff;            // -3dB frequency in Hz, 1..1000
+};
+
+/**
+ * High-pass filter that removes the INMP441's DC offset and sub-audio rumble before the
+ * equalizer and the volume gain can amplify them. It can be first order (a DC blocker,
+ * 6dB/octave) or a second order Butterworth (12dB/octave), or switched off.
+ *
+ * The arithmetic is fixed-point: Q30 coefficients, Q31 samples and a 64 bit accumulator.
+ * The part of the accumulator below the output LSB is carried into the next sample
+ * ("fraction saving"). Without it a pole this close to z = 1 truncates to a small DC error
+ * of its own and can sit in a limit cycle on silence. Coefficients are recalculated on the
+ * next call to process() after the order, cutoff or sample rate has changed, so the setters
+ * must be called from the same context as process().
+ */
+
+class HighPassFilter {
+
+  public:
+    enum Order {
+      OFF,
+      FIRST_ORDER,
+      SECOND_ORDER
+    };
+
+  private:
+    Order _order;
+    uint16_t _cutoff;         // Hz
+    uint32_t _sampleRate;
+    bool _dirty;
+
+    int32_t _b0, _b1, _b2;    // Q30, the first order filter only uses b0 and a1
+    int32_t _a1, _a2;         // Q30, negated so that everything is accumulated
+    int32_t _x1, _x2;
+    int32_t _y1, _y2;
+    uint32_t _fraction;       // accumulator bits below the output LSB
+
+  public:
+    HighPassFilter(uint32_t sampleRate);
+
+    void setOrder(Order order);
+    Order getOrder() const;
+    void setCutoff(uint16_t cutoff);
+    uint16_t getCutoff() const;
+    void setSampleRate(uint32_t sampleRate);
+
+    HighPassSettings getSettings() const;
+    void setSettings(const HighPassSettings &settings);
+    static bool validate(const HighPassSettings &settings);
+
+    void process(int32_t *iobuffer, uint16_t nSamples);
+
+  private:
+    void updateCoefficients();
+    void processFirstOrder(int32_t *iobuffer, uint16_t nSamples);
+    void processSecondOrder(int32_t *iobuffer, uint16_t nSamples);
+    static int32_t saturate(int64_t value);
+};
+
+/**
+ * Constructor: a first order filter at 20Hz
+ */
+
+inline HighPassFilter::HighPassFilter(uint32_t sampleRate) {
+  _order = FIRST_ORDER;
+  _cutoff = 20;
+  setSampleRate(sampleRate);
+}
+
+inline void HighPassFilter::setOrder(Order order) {
+  _order = order;
+  _dirty = true;
+}
+
+inline HighPassFilter::Order HighPassFilter::getOrder() const {
+  return _order;
+}
+
+/**
+ * Set the -3dB frequency
+ */
+
+inline void HighPassFilter::setCutoff(uint16_t cutoff) {
+  _cutoff = cutoff;
+  _dirty = true;
+}
+
+inline uint16_t HighPassFilter::getCutoff() const {
+  return _cutoff;
+}
+
+/**
+ * Change the sample rate. The filter state is cleared on the next call to process().
+ */
+
+inline void HighPassFilter::setSampleRate(uint32_t sampleRate) {
+  _sampleRate = sampleRate;
+  _dirty = true;
+}
+
+inline HighPassSettings HighPassFilter::getSettings() const {
+
+  HighPassSettings settings;
+
+  settings.order = _order;
+  settings.reserved = 0;
+  settings.cutoff = _cutoff;
+  return settings;
+}
+
+inline void HighPassFilter::setSettings(const HighPassSettings &settings) {
+  setOrder(static_cast<Order>(settings.order));
+  setCutoff(settings.cutoff);
+}
+
+/**
+ * Check settings received from the host
+ */
+
+inline bool HighPassFilter::validate(const HighPassSettings &settings) {
+  return settings.order <= SECOND_ORDER && settings.cutoff >= 1 && settings.cutoff <= 1000;
+}
+
+/**
+ * The first order filter is y = b0 * (x - x1) + a1 * y1 with its pole at exp(-2.pi.fc/fs) and
+ * b0 normalising the gain at Nyquist to one. The second order filter is the RBJ audio EQ
+ * cookbook high-pass with Q = 1/sqrt(2).
+ */
+
+inline void HighPassFilter::updateCoefficients() {
+
+  float w0 = 2 * (float) M_PI * _cutoff / _sampleRate;
+
+  _b0 = 1 << 30;
+  _b1 = _b2 = _a1 = _a2 = 0;
+
+  if (_order == FIRST_ORDER) {
+
+    float pole = expf(-w0);
+
+    _b0 = (int32_t) lrintf((1 + pole) / 2 * (1 << 30));
+    _a1 = (int32_t) lrintf(pole * (1 << 30));
+  }
+  else if (_order == SECOND_ORDER) {
+
+    float cosw0 = cosf(w0);
+    float alpha = sinf(w0) / (2 * (float) M_SQRT1_2);
+    float a0 = 1 + alpha;
+
+    _b0 = (int32_t) lrintf((1 + cosw0) / 2 / a0 * (1 << 30));
+    _b1 = -2 * _b0;
+    _b2 = _b0;
+    _a1 = (int32_t) lrintf(2 * cosw0 / a0 * (1 << 30));
+    _a2 = (int32_t) lrintf(-(1 - alpha) / a0 * (1 << 30));
+  }
+
+  _x1 = _x2 = _y1 = _y2 = 0;
+  _fraction = 0;
+}
+
+inline int32_t HighPassFilter::saturate(int64_t value) {
+  return value > INT32_MAX ? INT32_MAX : value < INT32_MIN ? INT32_MIN : (int32_t) value;
+}
+
+/**
+ * First order. x - x1 needs 33 bits.
+ */
+
+inline void HighPassFilter::processFirstOrder(int32_t *iobuffer, uint16_t nSamples) {
+
+  const int64_t b0 = _b0, a1 = _a1;
+  int32_t x1 = _x1, y1 = _y1;
+  uint32_t fraction = _fraction;
+
+  for (uint16_t i = 0; i < nSamples; i++) {
+
+    int32_t x = iobuffer[i];
+    int64_t acc = b0 * ((int64_t) x - x1) + a1 * y1 + fraction;
+
+    fraction = acc & ((1 << 30) - 1);
+    y1 = saturate(acc >> 30);
+    x1 = x;
+
+    iobuffer[i] = y1;
+  }
+
+  _x1 = x1;
+  _y1 = y1;
+  _fraction = fraction;
+}
+
+/**
+ * Second order, direct form I. The partial sums can exceed 64 bits on a full scale step but
+ * the total can't so they're accumulated with wrap-around.
+ */
+
+inline void HighPassFilter::processSecondOrder(int32_t *iobuffer, uint16_t nSamples) {
+
+  const int64_t b0 = _b0, b1 = _b1, b2 = _b2, a1 = _a1, a2 = _a2;
+  int32_t x1 = _x1, x2 = _x2, y1 = _y1, y2 = _y2;
+  uint32_t fraction = _fraction;
+
+  for (uint16_t i = 0; i < nSamples; i++) {
+
+    int32_t x = iobuffer[i];
+    uint64_t acc = fraction;
+
+    acc += (uint64_t) (b0 * x);
+    acc += (uint64_t) (b1 * x1);
+    acc += (uint64_t) (b2 * x2);
+    acc += (uint64_t) (a1 * y1);
+    acc += (uint64_t) (a2 * y2);
+
+    fraction = acc & ((1 << 30) - 1);
+
+    x2 = x1;
+    x1 = x;
+    y2 = y1;
+    y1 = saturate((int64_t) acc >> 30);
+
+    iobuffer[i] = y1;
+  }
+
+  _x1 = x1;
+  _x2 = x2;
+  _y1 = y1;
+  _y2 = y2;
+  _fraction = fraction;
+}
+
+/**
+ * Process a block of mono Q31 samples in place
+ */
+
+inline void HighPassFilter::process(int32_t *iobuffer, uint16_t nSamples) {
+
+  if (_dirty) {
+    updateCoefficients();
+    _dirty = false;
+  }
+
+  if (_order == FIRST_ORDER) {
+    processFirstOrder(iobuffer, nSamples);
+  }
+  else if (_order == SECOND_ORDER) {
+    processSecondOrder(iobuffer, nSamples);
+  }
+}
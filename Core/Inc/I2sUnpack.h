@@ -0,0 +1,59 @@
+/*
+ * This file is part of the firmware for the Andy's Workshop USB Microphone.
+ * Copyright 2021 Andy Brown. See https://andybrown.me.uk for project details.
+ * This project is open source subject to the license published on https://andybrown.me.uk.
+ */
+
+#pragma once
+
+/**
+ * Conversion of the I2S DMA buffer into Q31 mono samples. Each 64 bit frame is a 32 bit left
+ * slot carrying the 24 bit sample left-justified followed by the empty right slot. The DMA
+ * stores each slot as two half-words, most significant first, so rotating the word by 16 bits
+ * gives the sample as Q31.
+ *
+ * The caller must have finished with the DMA's half-complete or complete interrupt, and passed
+ * a memory barrier, before the block is read here. The buffer is then stable for half a DMA
+ * period so it's read through a plain pointer, letting the compiler merge the loads of four
+ * frames into one LDM.
+ */
+
+class I2sUnpack {
+
+  public:
+    static void toQ31(const int32_t *frames, int32_t *samples, uint16_t nSamples);
+};
+
+/**
+ * Unpack nSamples frames, four to an iteration
+ */
+
+inline void I2sUnpack::toQ31(const int32_t *frames, int32_t *samples, uint16_t nSamples) {
+
+  uint16_t blocks = nSamples / 4;
+
+  while (blocks--) {
+
+    // the right slots at 1, 3, 5 and 7 are loaded with the left ones and discarded
+
+    int32_t f0 = frames[0];
+    int32_t f1 = frames[2];
+    int32_t f2 = frames[4];
+    int32_t f3 = frames[6];
+
+    samples[0] = __ROR(f0, 16);
+    samples[1] = __ROR(f1, 16);
+    samples[2] = __ROR(f2, 16);
+    samples[3] = __ROR(f3, 16);
+
+    frames += 8;
+    samples += 4;
+  }
+
+  // 44.1kHz blocks aren't a multiple of four
+
+  for (nSamples %= 4; nSamples; nSamples--) {
+    *samples++ = __ROR(*frames, 16);
+    frames += 2;
+  }
+}
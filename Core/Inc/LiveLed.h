@@ -12,4 +12,12 @@ struct LiveLed: Led {
 
       off();
     }
+
+    /**
+     * Fully lit while speech is detected and a dim glow, lit for 1ms in 8, while live but silent
+     */
+
+    void show(bool live, bool speaking) const {
+      setState(live && (speaking || (HAL_GetTick() & 7) == 0));
+    }
 };
@@ -6,60 +6,95 @@
 
 #pragma once
 
+/**
+ * The mute button toggles mute on each press. Its interrupts are in MuteButton.cpp and the
+ * events are timestamped with the audio frame on which the edge happened so that the gain
+ * ramp can start on that frame (see Audio::followMuteButton).
+ */
+
 class MuteButton: public Button {
 
   private:
     volatile bool _muted;
+    volatile uint32_t _changeTime;
     bool _ignoreNextUp;
 
+  public:
+    static MuteButton *_instance;
+
   public:
     MuteButton();
 
     void run();
     bool isMuted() const;
+    uint32_t getChangeTime() const;
+
+  private:
+    void setMuted(bool muted, uint32_t timestamp);
 };
 
 inline MuteButton::MuteButton() :
-    Button(GpioPin(MUTE_GPIO_Port, MUTE_Pin), false) {
+    Button(GpioPin(MUTE_GPIO_Port, MUTE_Pin), false, TIM7) {
 
+  MuteButton::_instance = this;
   _muted = false;
+  _changeTime = 0;
   _ignoreNextUp = false;
 }
 
+/**
+ * Act on the presses and releases that the interrupts have queued (called from the main loop)
+ */
+
 inline void MuteButton::run() {
 
-  Button::CurrentState state = getAndClearCurrentState();
+  Button::Event event;
 
-  // check for idle
+  while (getEvent(event)) {
 
-  if (state == Button::CurrentState::None) {
-    return;
-  }
+    if (event.state == Down) {
 
-  if (state == Down) {
-
-    if (!_muted) {
-      _muted = true;
-      _ignoreNextUp = true;   // the lifting of the button shouldn't exit mute
+      if (!_muted) {
+        setMuted(true, event.timestamp);
+        _ignoreNextUp = true;   // the lifting of the button shouldn't exit mute
+      }
     }
-  }
-  else {
+    else {
 
-    if (_muted) {
+      if (_muted) {
 
-      if (_ignoreNextUp) {
+        if (_ignoreNextUp) {
 
-        // this is the lifting of the button that went into mute
+          // this is the lifting of the button that went into mute
 
-        _ignoreNextUp = false;
-      }
-      else {
-        _muted = false;
+          _ignoreNextUp = false;
+        }
+        else {
+          setMuted(false, event.timestamp);
+        }
       }
     }
   }
 }
 
+/**
+ * The audio processing can preempt the main loop so the time is stored first
+ */
+
+inline void MuteButton::setMuted(bool muted, uint32_t timestamp) {
+  _changeTime = timestamp;
+  __DMB();
+  _muted = muted;
+}
+
 inline bool MuteButton::isMuted() const {
   return _muted;
 }
+
+/**
+ * The frame on which the button last changed the mute state
+ */
+
+inline uint32_t MuteButton::getChangeTime() const {
+  return _changeTime;
+}
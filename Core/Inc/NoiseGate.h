@@ -0,0 +1,191 @@
+/*
+ * This file is part of the firmware for the Andy's Workshop USB Microphone.
+ * Copyright 2021 Andy Brown. See https://andybrown.me.uk for project details.
+ * This project is open source subject to the license published on https://andybrown.me.uk.
+ */
+
+#pragma once
+
+#include <math.h>
+
+/**
+ * The noise gate parameters as exchanged with the host by the MIC_VENDOR_REQ_GATE vendor
+ * request. All values are little-endian.
+ */
+
+struct NoiseGateSettings {
+    uint8_t enabled;            // 0 or 1
+    int8_t threshold;           // dBFS at which the gate opens, -96..0
+    int8_t range;               // gain when closed in dB, -96..0
+    uint8_t voiceKeyed;         // 1 to hold the gate open while the voice activity detector hears speech
+    uint16_t attack;            // ms for the gate to open, 0..1000
+    uint16_t hold;              // ms that the gate stays open after the signal drops, 0..5000
+    uint16_t release;           // ms for the gate to close, 1..5000
+};
+
+/**
+ * Noise gate, or downward expander when the range is shallow, that sits in front of the volume
+ * gain. It opens as soon as a sample exceeds the threshold, stays open for the hold time after
+ * the last one and then closes down to the range. It can also be held open by the voice
+ * activity detector so that quiet speech isn't gated. The gain moves towards fully open with the
+ * attack time constant and towards closed with the release time constant.
+ *
+ * The gain and the smoothing coefficients are Q30 and are applied with 64 bit products, as in
+ * VolumeLimiter. A 5000ms release at 96kHz still has a coefficient of over 2000 so the whole
+ * validated range of times is distinct. A disabled gate is skipped by the caller before
+ * process() is reached.
+ */
+
+class NoiseGate {
+
+  private:
+    static const int32_t UNITY_GAIN = 1 << 30;
+
+    NoiseGateSettings _settings;
+    uint32_t _sampleRate;
+
+    int32_t _threshold;       // Q31
+    int32_t _floor;           // Q30
+    int32_t _attack;          // Q30 smoothing coefficients
+    int32_t _release;
+    uint32_t _holdSamples;
+
+    int32_t _gain;            // Q30
+    uint32_t _holdCount;
+
+  public:
+    NoiseGate(uint32_t sampleRate);
+
+    void setSettings(const NoiseGateSettings &settings);
+    const NoiseGateSettings& getSettings() const;
+    bool isEnabled() const;
+    void setSampleRate(uint32_t sampleRate);
+
+    void process(int32_t *iobuffer, uint16_t nSamples, bool voice);
+
+    static bool validate(const NoiseGateSettings &settings);
+
+  private:
+    void updateCoefficients();
+    static int32_t coefficient(uint16_t ms, uint32_t sampleRate);
+};
+
+/**
+ * Constructor: disabled, opening at -50dBFS and closing to -40dB
+ */
+
+inline NoiseGate::NoiseGate(uint32_t sampleRate) {
+
+  _settings.enabled = 0;
+  _settings.threshold = -50;
+  _settings.range = -40;
+  _settings.voiceKeyed = 0;
+  _settings.attack = 1;
+  _settings.hold = 200;
+  _settings.release = 150;
+
+  _sampleRate = sampleRate;
+  updateCoefficients();
+}
+
+/**
+ * Check settings received from the host
+ */
+
+inline bool NoiseGate::validate(const NoiseGateSettings &settings) {
+  return settings.enabled <= 1 && settings.voiceKeyed <= 1 && settings.threshold >= -96 && settings.threshold <= 0 && settings.range >= -96
+      && settings.range <= 0 && settings.attack <= 1000 && settings.hold <= 5000 && settings.release >= 1
+      && settings.release <= 5000;
+}
+
+/**
+ * Apply new settings. The gate starts open so that enabling it doesn't cut off the start of
+ * whatever is being said at the time.
+ */
+
+inline void NoiseGate::setSettings(const NoiseGateSettings &settings) {
+  _settings = settings;
+  updateCoefficients();
+}
+
+inline const NoiseGateSettings& NoiseGate::getSettings() const {
+  return _settings;
+}
+
+inline bool NoiseGate::isEnabled() const {
+  return _settings.enabled;
+}
+
+inline void NoiseGate::setSampleRate(uint32_t sampleRate) {
+  _sampleRate = sampleRate;
+  updateCoefficients();
+}
+
+/**
+ * One-pole smoothing coefficient that settles to within 1/e in the given time. expm1f() keeps
+ * the precision of the small coefficients of the long times that 1 - expf() would lose.
+ */
+
+inline int32_t NoiseGate::coefficient(uint16_t ms, uint32_t sampleRate) {
+
+  if (ms == 0) {
+    return UNITY_GAIN;
+  }
+
+  int32_t coefficient = (int32_t) (-UNITY_GAIN * expm1f(-1000.0f / (ms * (float) sampleRate)));
+  return coefficient < 1 ? 1 : coefficient;
+}
+
+inline void NoiseGate::updateCoefficients() {
+
+  _threshold = (int32_t) (2147483647.0f * powf(10, _settings.threshold / 20.0f));
+  _floor = (int32_t) (UNITY_GAIN * powf(10, _settings.range / 20.0f));
+  _attack = coefficient(_settings.attack, _sampleRate);
+  _release = coefficient(_settings.release, _sampleRate);
+
+  // the sample that crosses the threshold opens the gate even with no hold time
+
+  _holdSamples = _settings.hold * _sampleRate / 1000 + 1;
+
+  _gain = UNITY_GAIN;
+  _holdCount = _holdSamples;
+}
+
+/**
+ * Process a block of mono Q31 samples in place
+ * @param voice The voice activity detector's decision
+ */
+
+inline void NoiseGate::process(int32_t *iobuffer, uint16_t nSamples, bool voice) {
+
+  int32_t gain = _gain;
+  uint32_t holdCount = _holdCount;
+
+  // every magnitude is above -1
+
+  int32_t threshold = voice && _settings.voiceKeyed ? -1 : _threshold;
+
+  for (uint16_t i = 0; i < nSamples; i++) {
+
+    int32_t sample = iobuffer[i];
+
+    // one's complement is close enough to the magnitude and can't overflow
+
+    if ((sample ^ (sample >> 31)) > threshold) {
+      holdCount = _holdSamples;
+    } else if (holdCount) {
+      holdCount--;
+    }
+
+    if (holdCount) {
+      gain += (int32_t) (((int64_t) (UNITY_GAIN - gain) * _attack) >> 30);
+    } else {
+      gain += (int32_t) (((int64_t) (_floor - gain) * _release) >> 30);
+    }
+
+    iobuffer[i] = (int32_t) (((int64_t) sample * gain) >> 30);
+  }
+
+  _gain = gain;
+  _holdCount = holdCount;
+}
@@ -0,0 +1,277 @@
+/*
+ * This file is part of the firmware for the Andy's Workshop USB Microphone.
+ * Copyright 2021 Andy Brown. See https://andybrown.me.uk for project details.
+ * This project is open source subject to the license published on https://andybrown.me.uk.
+ */
+
+#pragma once
+
+/**
+ * The format returned to the host by the MIC_VENDOR_REQ_POWER vendor request. All values are
+ * little-endian 32 bit words.
+ */
+
+struct PowerReport {
+    uint32_t suspends;          // times the bus has been suspended
+    uint32_t resumes;           // resumes of a running stream that have been timed
+    uint32_t lastLatency;       // us from the wakeup to the first block of the restarted stream
+    uint32_t maxLatency;        // us
+    uint32_t target;            // us, MIC_RESUME_TARGET_MS
+    uint32_t overTarget;        // timed resumes that took longer than the target
+    uint32_t wakeup;            // us taken to restart the clocks after the last stop
+};
+
+/**
+ * The power states. The core runs at full speed while it's streaming and at a quarter of the
+ * speed while it isn't. When the host suspends the bus the stream is stopped and, if the USB
+ * is set up for low power, the core goes into stop mode with the PLLs off until the host
+ * resumes it. The USB interrupts in usbd_conf.c only record the changes and everything else
+ * happens in the main loop (see run()).
+ *
+ * A stream that was running when the bus was suspended is restarted by the host's first poll
+ * after the resume. The time from the wakeup until its first block is committed to the USB
+ * FIFO is measured against MIC_RESUME_TARGET_MS. The core stays at full speed from the resume
+ * until that block, or until RESUME_TIMEOUT_MILLIS if the host doesn't restart the stream, so
+ * the measurement is taken with the cycle counter at a constant rate. The time spent restarting
+ * the clocks after a stop is added to it.
+ */
+
+class PowerManager {
+
+  private:
+    static const uint32_t RESUME_TIMEOUT_MILLIS = 1000;
+
+    Audio &_audio;
+    CpuLoad &_cpuLoad;
+    volatile bool _suspended;         // between the suspend and the resume or reset
+    volatile bool _stopWhenSuspended;
+    volatile bool _resumePending;     // for the main loop
+    volatile bool _wasStreaming;      // when the bus was suspended
+    bool _reducedClock;
+    bool _timingResume;
+    uint32_t _wakeupMicros;           // to restart the clocks after the last stop
+    uint32_t _resumeCycles;
+    uint32_t _resumeTick;
+    uint32_t _resumeBlocks;
+    PowerReport _report;
+
+  public:
+    static PowerManager *_instance;
+
+  public:
+    PowerManager(Audio &audio);
+
+    void suspend(bool stop);
+    void resume(bool reset);
+    void run();
+
+    void getReport(PowerReport &report) const;
+    void reset();
+
+  private:
+    void setClock(bool reduced);
+    void stop();
+    void startTiming();
+    void checkTiming();
+};
+
+/**
+ * Constructor
+ */
+
+inline PowerManager::PowerManager(Audio &audio) :
+    _audio(audio), _cpuLoad(audio.getProfiler().getCpuLoad()) {
+
+  _suspended = false;
+  _stopWhenSuspended = false;
+  _resumePending = false;
+  _wasStreaming = false;
+  _reducedClock = false;
+  _timingResume = false;
+  _wakeupMicros = 0;
+  _resumeCycles = 0;
+  _resumeTick = 0;
+  _resumeBlocks = 0;
+
+  reset();
+  PowerManager::_instance = this;
+}
+
+/**
+ * Clear the statistics
+ */
+
+inline void PowerManager::reset() {
+  _report.suspends = 0;
+  _report.resumes = 0;
+  _report.lastLatency = 0;
+  _report.maxLatency = 0;
+  _report.target = MIC_RESUME_TARGET_MS * 1000;
+  _report.overTarget = 0;
+  _report.wakeup = 0;
+}
+
+/**
+ * The bus has been suspended (called from the USB interrupt). The stream is stopped here so
+ * that nothing is processed for a host that isn't listening and the main loop does the rest.
+ * @param stop true to go into stop mode, otherwise the core only runs at the reduced clock
+ */
+
+inline void PowerManager::suspend(bool stop) {
+
+  _wasStreaming = _audio.isRunning();
+  USBD_AUDIO_Suspend(&hUsbDeviceFS);
+
+  _stopWhenSuspended = stop;
+  _wakeupMicros = 0;
+  _report.suspends++;
+  __DMB();
+  _suspended = true;
+}
+
+/**
+ * The host has resumed or reset the bus (called from the USB interrupt). A reset ends the
+ * stream so there's nothing to time.
+ */
+
+inline void PowerManager::resume(bool reset) {
+
+  if (!_suspended) {
+    return;
+  }
+
+  if (reset) {
+    _wasStreaming = false;
+  }
+
+  _suspended = false;
+  _resumePending = true;
+}
+
+/**
+ * Follow the power state (called from the main loop before it sleeps)
+ */
+
+inline void PowerManager::run() {
+
+  if (_suspended && _stopWhenSuspended) {
+    stop();
+  }
+
+  if (_resumePending) {
+
+    _resumePending = false;
+
+    if (_wasStreaming) {
+      startTiming();
+    }
+  }
+
+  if (_timingResume) {
+    checkTiming();
+  }
+
+  // run at a quarter of the clock while there's no audio to process. The stream is started
+  // from the USB interrupt and this runs as soon as it returns, well before the first
+  // block is ready. A stop that ended early is tried again at full speed.
+
+  setClock(!_audio.isRunning() && !_timingResume && !(_suspended && _stopWhenSuspended));
+
+  _cpuLoad.update();
+}
+
+/**
+ * Change the core clock if it's not already at the requested speed. The CPU load window is
+ * restarted because its length in SysTick counts has changed.
+ */
+
+inline void PowerManager::setClock(bool reduced) {
+
+  if (reduced != _reducedClock) {
+
+    if (MX_SystemClock_SetReduced(reduced) != HAL_OK) {
+      Error_Handler();
+    }
+
+    _reducedClock = reduced;
+    _cpuLoad.restart();
+  }
+}
+
+/**
+ * Go into stop mode until the host resumes the bus. The core is put back to full speed first
+ * so that it wakes up at the full HSI rate and not a quarter of it. Interrupts are masked
+ * from the check of the state to the stop so that a resume in between ends it at once, and
+ * they stay masked until the clocks are back so that the USB interrupt isn't run from the
+ * HSI. Any other interrupt that ends the stop early is followed by another one.
+ */
+
+inline void PowerManager::stop() {
+
+  setClock(false);
+  _audio.setLed();
+
+  __disable_irq();
+
+  if (_suspended) {
+    _wakeupMicros = MX_EnterStopMode();
+    _report.wakeup = _wakeupMicros;
+  }
+
+  __enable_irq();
+
+  // SysTick stopped with the core
+
+  _cpuLoad.restart();
+}
+
+/**
+ * Start the measurement of the time to the first block of the restarted stream
+ */
+
+inline void PowerManager::startTiming() {
+
+  setClock(false);
+
+  _timingResume = true;
+  _resumeCycles = DWT->CYCCNT;
+  _resumeTick = HAL_GetTick();
+  _resumeBlocks = _audio.getBlocksSent();
+}
+
+/**
+ * Record the resume latency when the first block has been sent, or give up if the host hasn't
+ * restarted the stream in time
+ */
+
+inline void PowerManager::checkTiming() {
+
+  if (_audio.getBlocksSent() != _resumeBlocks) {
+
+    uint32_t latency = _wakeupMicros + (DWT->CYCCNT - _resumeCycles) / (SystemCoreClock / 1000000);
+
+    _report.resumes++;
+    _report.lastLatency = latency;
+
+    if (latency > _report.maxLatency) {
+      _report.maxLatency = latency;
+    }
+
+    if (latency > _report.target) {
+      _report.overTarget++;
+    }
+
+    _timingResume = false;
+  }
+  else if (HAL_GetTick() - _resumeTick > RESUME_TIMEOUT_MILLIS) {
+    _timingResume = false;
+  }
+}
+
+/**
+ * Get the statistics for the host
+ */
+
+inline void PowerManager::getReport(PowerReport &report) const {
+  report = _report;
+}
@@ -0,0 +1,219 @@
+/*
+ * This file is part of the firmware for the Andy's Workshop USB Microphone.
+ * Copyright 2021 Andy Brown. See https://andybrown.me.uk for project details.
+ * This project is open source subject to the license published on https://andybrown.me.uk.
+ */
+
+#pragma once
+
+/**
+ * Statistics for one stage of the audio processing, in CPU cycles
+ */
+
+struct ProfilerStage {
+    uint32_t min;
+    uint32_t max;
+    uint32_t last;
+    uint32_t count;
+    uint64_t total;
+};
+
+struct ProfilerReport;
+
+/**
+ * Per-stage cycle counting for Audio::sendData using the DWT cycle counter. Each block is
+ * bracketed by beginBlock()/endBlock() and each stage boundary is marked with endStage().
+ * The cost of a measurement is a single read of DWT->CYCCNT. Blocks that arrive before the
+ * previous one has been processed are counted with countOverrun(). The load on the whole
+ * CPU, including the USB and the main loop, is measured by the CpuLoad that it carries.
+ */
+
+class Profiler {
+
+  public:
+    enum Stage {
+      STAGE_CONVERSION,     // I2S frames to Q31
+      STAGE_HIGHPASS,       // HighPassFilter::process
+      STAGE_VAD,            // VoiceActivityDetector::process
+      STAGE_GATE,           // NoiseGate::process, only recorded while the gate is enabled
+      STAGE_EQUALIZER,      // GraphicEqualizer::process
+      STAGE_VOLUME,         // VolumeControl::process
+      STAGE_REQUANTISE,     // Dither::requantise, Q31 to the USB subframe format
+      STAGE_USB,            // USBD_AUDIO_Commit_Transfer
+      STAGE_TOTAL,          // the whole of sendData
+      STAGE_COUNT
+    };
+
+  private:
+    ProfilerStage _stages[STAGE_COUNT];
+    uint32_t _blockStart;
+    uint32_t _stageStart;
+    volatile uint32_t _overruns;
+    CpuLoad _cpuLoad;
+
+  public:
+    Profiler();
+
+    void reset();
+
+    void beginBlock();
+    void endStage(Stage stage);
+    void endBlock();
+    void countOverrun();
+
+    const ProfilerStage& getStage(Stage stage) const;
+    static const char* getStageName(Stage stage);
+    uint32_t getBudget() const;
+    CpuLoad& getCpuLoad();
+    void getReport(ProfilerReport &report) const;
+
+  private:
+    void record(Stage stage, uint32_t cycles);
+};
+
+/**
+ * The format returned to the host by the AUDIO_VENDOR_REQ_GET_PROFILE vendor request. All
+ * values are little-endian 32 bit words.
+ */
+
+struct ProfilerReport {
+    uint32_t coreClock;         // cycles per second
+    uint32_t budget;            // cycles available to process each block
+    uint32_t blocks;            // number of blocks measured
+    uint32_t overruns;          // blocks that arrived before the previous one was processed
+    struct {
+        uint32_t min;
+        uint32_t mean;
+        uint32_t max;
+    } stages[Profiler::STAGE_COUNT];
+    uint32_t cpuLoad;           // time that the core was awake over the last second in 0.1%
+};
+
+/**
+ * Constructor: enable the cycle counter
+ */
+
+inline Profiler::Profiler() {
+
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CYCCNT = 0;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+  _blockStart = _stageStart = 0;
+  reset();
+}
+
+/**
+ * Clear the statistics
+ */
+
+inline void Profiler::reset() {
+
+  for (uint8_t i = 0; i < STAGE_COUNT; i++) {
+    _stages[i].min = UINT32_MAX;
+    _stages[i].max = 0;
+    _stages[i].last = 0;
+    _stages[i].count = 0;
+    _stages[i].total = 0;
+  }
+
+  _overruns = 0;
+}
+
+inline void Profiler::beginBlock() {
+  _blockStart = _stageStart = DWT->CYCCNT;
+}
+
+/**
+ * A stage has finished. The cycles since the end of the previous stage are charged to it.
+ */
+
+inline void Profiler::endStage(Stage stage) {
+
+  uint32_t now = DWT->CYCCNT;
+
+  record(stage, now - _stageStart);
+  _stageStart = now;
+}
+
+inline void Profiler::endBlock() {
+  record(STAGE_TOTAL, DWT->CYCCNT - _blockStart);
+}
+
+/**
+ * A block has arrived before processing of the previous one finished (called from the
+ * DMA interrupt)
+ */
+
+inline void Profiler::countOverrun() {
+  _overruns++;
+}
+
+inline void Profiler::record(Stage stage, uint32_t cycles) {
+
+  ProfilerStage &s = _stages[stage];
+
+  if (cycles < s.min) {
+    s.min = cycles;
+  }
+  if (cycles > s.max) {
+    s.max = cycles;
+  }
+
+  s.last = cycles;
+  s.total += cycles;
+  s.count++;
+}
+
+inline const ProfilerStage& Profiler::getStage(Stage stage) const {
+  return _stages[stage];
+}
+
+/**
+ * A short name for printing
+ */
+
+inline const char* Profiler::getStageName(Stage stage) {
+
+  static const char *names[STAGE_COUNT] = { "conversion", "highpass", "vad", "gate", "equalizer", "volume", "requantise", "usb", "total" };
+  return names[stage];
+}
+
+/**
+ * The number of cycles between DMA half-complete interrupts
+ */
+
+inline uint32_t Profiler::getBudget() const {
+  return (SystemCoreClock / 1000) * (MIC_MS_PER_PACKET / 2);
+}
+
+/**
+ * Get a reference to the CPU load measurement that the main loop sleeps through
+ */
+
+inline CpuLoad& Profiler::getCpuLoad() {
+  return _cpuLoad;
+}
+
+/**
+ * Fill in the report structure sent to the host
+ */
+
+inline void Profiler::getReport(ProfilerReport &report) const {
+
+  report.coreClock = SystemCoreClock;
+  report.budget = getBudget();
+  report.blocks = _stages[STAGE_TOTAL].count;
+  report.overruns = _overruns;
+
+  for (uint8_t i = 0; i < STAGE_COUNT; i++) {
+
+    const ProfilerStage &s = _stages[i];
+
+    report.stages[i].min = s.count ? s.min : 0;
+    report.stages[i].mean = s.count ? s.total / s.count : 0;
+    report.stages[i].max = s.max;
+  }
+
+  report.cpuLoad = _cpuLoad.getLoad();
+}
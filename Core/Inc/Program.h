@@ -7,7 +7,8 @@
 #pragma once
 
 /**
- * Main program class
+ * Main program class. Everything that has to happen on time is done in interrupts and the
+ * main loop only picks up what they've left for it, so it spends most of its time asleep.
  */
 
 class Program {
@@ -19,26 +20,111 @@ class Program {
     Audio _audio;
     GraphicEqualizer _graphicEqualiser;
     VolumeControl _volumeControl;
+    PowerManager _powerManager;
 
   public:
     Program();
 
     void run();
+
+#ifdef SEMIHOSTING
+  private:
+    void reportProfile();
+    void reportPower();
+#endif
 };
 
 inline Program::Program() :
-    _audio(_muteButton, _liveLed, _graphicEqualiser, _volumeControl) {
+    _audio(_muteButton, _liveLed, _graphicEqualiser, _volumeControl), _powerManager(_audio) {
 }
 
 inline void Program::run() {
 
-  // infinite loop
+  CpuLoad &cpuLoad = _audio.getProfiler().getCpuLoad();
+
+#ifdef SEMIHOSTING
+  uint32_t lastReport = HAL_GetTick();
+#endif
+
+  // infinite loop. The audio and the button are handled in interrupts so the core sleeps
+  // between them. SysTick wakes it every millisecond to dim the live LED.
 
   for (;;) {
 
-    // process the mute button
+    // act on the mute button's presses and releases
 
     _muteButton.run();
     _audio.setLed();
+
+    // set the clock for what's going on, or stop until the host resumes a suspended bus
+
+    _powerManager.run();
+
+#ifdef SEMIHOSTING
+
+    // print the processing profile every 10 seconds
+
+    if (HAL_GetTick() - lastReport > 10000) {
+      reportProfile();
+      reportPower();
+      lastReport = HAL_GetTick();
+    }
+#endif
+
+    // an interrupt that arrives after the check still ends the WFI because it's only masked
+
+    __disable_irq();
+
+    if (!_muteButton.hasEvents()) {
+      cpuLoad.sleep();
+    }
+
+    __enable_irq();
   }
 }
+
+#ifdef SEMIHOSTING
+
+/**
+ * Print the per-stage cycle counts for Audio::sendData and the load on the whole CPU
+ */
+
+inline void Program::reportProfile() {
+
+  ProfilerReport report;
+  _audio.getProfiler().getReport(report);
+
+  printf("%lu blocks, %lu overruns, budget %lu cycles\n", report.blocks, report.overruns, report.budget);
+
+  for (uint8_t i = 0; i < Profiler::STAGE_COUNT; i++) {
+    printf("  %-10s min %7lu mean %7lu max %7lu\n", Profiler::getStageName((Profiler::Stage) i),
+        report.stages[i].min, report.stages[i].mean, report.stages[i].max);
+  }
+
+  // the slowest block can take longer than the budget so the headroom is signed
+
+  uint32_t used = (uint64_t) report.stages[Profiler::STAGE_TOTAL].max * 100 / report.budget;
+
+  if (used <= 100) {
+    printf("  headroom %lu%%\n", 100 - used);
+  } else {
+    printf("  headroom -%lu%%, the slowest block overran its budget\n", used - 100);
+  }
+  printf("  cpu load %lu.%lu%%\n", report.cpuLoad / 10, report.cpuLoad % 10);
+}
+
+/**
+ * Print the suspend and resume statistics
+ */
+
+inline void Program::reportPower() {
+
+  PowerReport report;
+  _powerManager.getReport(report);
+
+  printf("%lu suspends, %lu resumes timed, latency last %luus max %luus, %lu over %luus, wakeup %luus\n",
+      report.suspends, report.resumes, report.lastLatency, report.maxLatency, report.overTarget, report.target,
+      report.wakeup);
+}
+
+#endif
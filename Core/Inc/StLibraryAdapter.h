@@ -0,0 +1,63 @@
+/*
+ * This file is part of the firmware for the Andy's Workshop USB Microphone.
+ * Copyright 2021 Andy Brown. See https://andybrown.me.uk for project details.
+ * This project is open source subject to the license published on https://andybrown.me.uk.
+ */
+
+#pragma once
+
+/**
+ * The ST GREQ and SVC libraries only process interleaved stereo 16 bit samples and fail any
+ * other format. A mono Q31 sample and a 16 bit stereo frame are both 32 bits so the block is
+ * converted in place: the equalizer rounds each sample to 16 bits into both halves of its own
+ * word before it runs and the volume control shifts the left half back up to Q31 after it has
+ * run. The block stays stereo from one library to the other so nothing else can process it in
+ * between. When only one of the libraries is used it does both conversions itself.
+ *
+ * That rounding is the one requantisation in front of the libraries. Everything below the 16
+ * bit LSB (-96dBFS) is lost there and the SVC gain of up to +36dB amplifies what's left, so
+ * the full resolution of the microphone only survives the chain with the native engines
+ * (USE_NATIVE_GREQ and USE_NATIVE_SVC).
+ */
+
+class StLibraryAdapter {
+
+  public:
+    // the libraries' scratch memory is sized for the 10ms at 48kHz that they have always been
+    // given, so longer blocks are passed to them in chunks of this many frames
+    static const uint16_t CHUNK_FRAMES = 480;
+
+  public:
+    static void toStereo(int32_t *samples, uint16_t nFrames);
+    static void toMono(int32_t *samples, uint16_t nFrames);
+};
+
+/**
+ * Round a block of Q31 samples to 16 bits in both channels. Rounding up from the top of the
+ * range saturates.
+ */
+
+inline void StLibraryAdapter::toStereo(int32_t *samples, uint16_t nFrames) {
+
+  for (uint16_t i = 0; i < nFrames; i++) {
+
+    int32_t sample = (samples[i] >> 16) + ((samples[i] >> 15) & 1);
+
+    if (sample > INT16_MAX) {
+      sample = INT16_MAX;
+    }
+
+    samples[i] = (int32_t) (((uint32_t) sample << 16) | (uint16_t) sample);
+  }
+}
+
+/**
+ * Take the processed left channel, the low half of each frame, back as Q31
+ */
+
+inline void StLibraryAdapter::toMono(int32_t *samples, uint16_t nFrames) {
+
+  for (uint16_t i = 0; i < nFrames; i++) {
+    samples[i] = (int32_t) ((uint32_t) samples[i] << 16);
+  }
+}
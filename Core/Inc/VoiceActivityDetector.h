@@ -0,0 +1,189 @@
+/*
+ * This file is part of the firmware for the Andy's Workshop USB Microphone.
+ * Copyright 2021 Andy Brown. See https://andybrown.me.uk for project details.
+ * This project is open source subject to the license published on https://andybrown.me.uk.
+ */
+
+#pragma once
+
+#include <math.h>
+
+/**
+ * Energy and zero-crossing voice activity detector. The samples are gathered into 10ms frames
+ * whatever the processing block size, and a decision is made at the end of each frame:
+ *
+ *   - a frame 12dB or more above the background is speech
+ *   - a frame 6dB or more above the background is speech if its zero-crossing rate is that of
+ *     a voiced sound, i.e. a fundamental between 50Hz and 3kHz. Hiss and clicks cross much
+ *     more often than that.
+ *
+ * The background level follows the quietest frames down straight away and creeps back up at
+ * 5dB per second while there's no speech. Speech is held for 300ms after the last speech frame
+ * so that the gaps between words don't count as silence.
+ *
+ * The per-sample work is a square and a sign test at 16 bit resolution. The log and the
+ * decision are done once per frame in single precision.
+ */
+
+class VoiceActivityDetector {
+
+  private:
+    static constexpr float STRONG_MARGIN = 12;    // dB
+    static constexpr float WEAK_MARGIN = 6;
+    static constexpr float NOISE_RISE = 0.05f;    // dB per frame
+    static constexpr float LEVEL_FLOOR = -90;     // dBFS
+    static const uint16_t HANGOVER_FRAMES = 30;
+
+    uint16_t _frameLength;
+    uint16_t _frameCount;
+    uint64_t _energy;
+    uint16_t _crossings;
+    int32_t _previous;
+
+    float _noiseLevel;        // dBFS
+    bool _primed;             // the background level has been set
+    uint16_t _hangover;
+    volatile bool _active;
+
+    uint32_t _frames;
+    uint32_t _activeFrames;
+
+  public:
+    VoiceActivityDetector(uint32_t sampleRate);
+
+    void setSampleRate(uint32_t sampleRate);
+    void process(const int32_t *samples, uint16_t nSamples);
+
+    bool isActive() const;
+    uint32_t getFrames() const;
+    uint32_t getActiveFrames() const;
+
+  private:
+    void decide();
+};
+
+/**
+ * Constructor
+ */
+
+inline VoiceActivityDetector::VoiceActivityDetector(uint32_t sampleRate) {
+  _frames = _activeFrames = 0;
+  setSampleRate(sampleRate);
+}
+
+/**
+ * Change the sample rate. The detector starts again from silence.
+ */
+
+inline void VoiceActivityDetector::setSampleRate(uint32_t sampleRate) {
+
+  _frameLength = sampleRate / 100;
+  _frameCount = 0;
+  _energy = 0;
+  _crossings = 0;
+  _previous = 0;
+  _noiseLevel = LEVEL_FLOOR;
+  _primed = false;
+  _hangover = 0;
+  _active = false;
+}
+
+inline bool VoiceActivityDetector::isActive() const {
+  return _active;
+}
+
+/**
+ * The number of 10ms frames seen and the number of them that were speech, for offline testing
+ */
+
+inline uint32_t VoiceActivityDetector::getFrames() const {
+  return _frames;
+}
+
+inline uint32_t VoiceActivityDetector::getActiveFrames() const {
+  return _activeFrames;
+}
+
+/**
+ * Accumulate a block of mono Q31 samples, deciding at the end of each frame
+ */
+
+inline void VoiceActivityDetector::process(const int32_t *samples, uint16_t nSamples) {
+
+  uint64_t energy = _energy;
+  uint16_t crossings = _crossings;
+  int32_t previous = _previous;
+  uint16_t frameCount = _frameCount;
+
+  for (uint16_t i = 0; i < nSamples; i++) {
+
+    int32_t sample = samples[i] >> 16;
+
+    energy += sample * sample;
+    crossings += (sample ^ previous) < 0;
+    previous = sample;
+
+    if (++frameCount == _frameLength) {
+
+      _energy = energy;
+      _crossings = crossings;
+      decide();
+
+      energy = 0;
+      crossings = 0;
+      frameCount = 0;
+    }
+  }
+
+  _energy = energy;
+  _crossings = crossings;
+  _previous = previous;
+  _frameCount = frameCount;
+}
+
+/**
+ * Classify the frame that has just been completed
+ */
+
+inline void VoiceActivityDetector::decide() {
+
+  float level = 10 * log10f((float) _energy / _frameLength / 1073741824.0f + 1e-10f);
+
+  if (level < LEVEL_FLOOR) {
+    level = LEVEL_FLOOR;
+  }
+
+  // the first frame after a reset sets the background level
+
+  if (!_primed) {
+    _noiseLevel = level;
+    _primed = true;
+  }
+
+  // two crossings per cycle and 100 frames per second
+
+  uint32_t frequency = _crossings * 50;
+  bool voiced = frequency >= 50 && frequency <= 3000;
+
+  bool speech = level >= _noiseLevel + STRONG_MARGIN || (voiced && level >= _noiseLevel + WEAK_MARGIN);
+
+  if (level < _noiseLevel) {
+    _noiseLevel = level;
+  } else if (!speech) {
+    _noiseLevel += NOISE_RISE;
+  }
+
+  if (speech) {
+    _hangover = HANGOVER_FRAMES;
+  } else if (_hangover) {
+    _hangover--;
+  }
+
+  _active = _hangover != 0;
+
+  _frames++;
+
+  if (_active) {
+    _activeFrames++;
+  }
+}
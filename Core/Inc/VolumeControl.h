@@ -9,11 +9,22 @@
 /**
  * Service class to manage the API to the ST SVC library. This is provided as a closed source
  * but free-to-use library by ST Micro. See UM1642 for details.
+ *
+ * If USE_NATIVE_SVC is defined then the in-tree VolumeLimiter is used instead of the library.
  */
 
 class VolumeControl {
 
+  public:
+#ifdef USE_NATIVE_SVC
+    // 1ms of look-ahead at any sample rate. The ST library uses 100 samples.
+    static const uint16_t LOOKAHEAD_MS = 1;
+#endif
+
   private:
+#ifdef USE_NATIVE_SVC
+    VolumeLimiter _engine;
+#else
     uint8_t *_svcPersistent;
     uint8_t *_svcScratch;
 
@@ -21,6 +32,7 @@ class VolumeControl {
     buffer_t _svcOutput;
 
     svc_dynamic_param_t _dynamicParams;
+#endif
 
   public:
     VolumeControl();
@@ -28,14 +40,48 @@ class VolumeControl {
     void setMute(bool mute);
     void setVolume(int16_t volume);
     bool isMuted() const;
+    void setSampleRate(uint32_t sampleRate);
 
-    void process(int16_t *iobuffer, int32_t nSamples);
+    void process(int32_t *iobuffer, int32_t nSamples);
 };
 
 /**
  * Constructor
  */
 
+#ifdef USE_NATIVE_SVC
+
+inline VolumeControl::VolumeControl()
+    : _engine(MIC_SAMPLE_FREQUENCY, MIC_SAMPLE_FREQUENCY / 1000 * LOOKAHEAD_MS,
+        MIC_MAX_SAMPLE_FREQUENCY / 1000 * LOOKAHEAD_MS) {
+
+  // set the initial volume
+
+  setVolume(1);
+}
+
+inline void VolumeControl::setVolume(int16_t volume) {
+  _engine.setVolume(volume);
+}
+
+inline void VolumeControl::setMute(bool mute) {
+  _engine.setMute(mute);
+}
+
+inline bool VolumeControl::isMuted() const {
+  return _engine.isMuted();
+}
+
+inline void VolumeControl::setSampleRate(uint32_t sampleRate) {
+  _engine.setSampleRate(sampleRate, sampleRate / 1000 * LOOKAHEAD_MS);
+}
+
+inline void VolumeControl::process(int32_t *iobuffer, int32_t nSamples) {
+  _engine.process(iobuffer, nSamples);
+}
+
+#else
+
 inline VolumeControl::VolumeControl() {
 
   // allocate space required by the SVC library
@@ -54,7 +100,7 @@ inline VolumeControl::VolumeControl() {
   svc_static_param_t param;
 
   param.delay_len = 100;
-  param.joint_stereo = 1;
+  param.joint_stereo = 1;     // the two channels are the same
 
   if (svc_setParam(&param, _svcPersistent) != SVC_ERROR_NONE) {
     Error_Handler();
@@ -72,10 +118,10 @@ inline VolumeControl::VolumeControl() {
   _dynamicParams.attack_time = 2103207220;
   _dynamicParams.release_time = 2146924480;
 
-  // buffer constants
+  // buffer constants. The library only accepts 16 bit stereo so the adapter converts to it.
 
   _svcInput.nb_channels = _svcOutput.nb_channels = 2;
-  _svcInput.nb_bytes_per_Sample = _svcOutput.nb_bytes_per_Sample = 2;
+  _svcInput.nb_bytes_per_Sample = _svcOutput.nb_bytes_per_Sample = 2;    // 16 bit only
   _svcInput.mode = _svcOutput.mode = INTERLEAVED;
 
   // set the initial volume
@@ -121,22 +167,40 @@ inline bool VolumeControl::isMuted() const {
 }
 
 /**
- * Process a sample buffer
+ * The SVC library has no sample rate parameter. Its delay line and timings are fixed in
+ * samples so the attack and release scale with the rate.
+ */
+
+inline void VolumeControl::setSampleRate(uint32_t sampleRate) {
+}
+
+/**
+ * Process the block of mono Q31 samples in place. The ST equalizer has already left it as 16
+ * bit stereo, or it's converted here if the native equalizer processed it.
  */
 
-inline void VolumeControl::process(int16_t *iobuffer, int32_t nSamples) {
+inline void VolumeControl::process(int32_t *iobuffer, int32_t nSamples) {
 
-  // initialise the buffer parameters
+#ifdef USE_NATIVE_GREQ
+  StLibraryAdapter::toStereo(iobuffer, nSamples);
+#endif
 
-  _svcInput.buffer_size = _svcOutput.buffer_size = nSamples;
+  for (int32_t offset = 0; offset < nSamples; offset += StLibraryAdapter::CHUNK_FRAMES) {
 
-  _svcInput.data_ptr = iobuffer;
-  _svcOutput.data_ptr = iobuffer;
+    uint16_t nFrames = nSamples - offset < StLibraryAdapter::CHUNK_FRAMES ? nSamples - offset : StLibraryAdapter::CHUNK_FRAMES;
 
-  // call the library method
+    _svcInput.data_ptr = _svcOutput.data_ptr = iobuffer + offset;
+    _svcInput.buffer_size = _svcOutput.buffer_size = nFrames;
 
-  int32_t error = svc_process(&_svcInput, &_svcOutput, _svcPersistent);
-  if (error != SVC_ERROR_NONE) {
-    Error_Handler();
+    // call the library method
+
+    int32_t error = svc_process(&_svcInput, &_svcOutput, _svcPersistent);
+    if (error != SVC_ERROR_NONE) {
+      Error_Handler();
+    }
   }
+
+  StLibraryAdapter::toMono(iobuffer, nSamples);
 }
+
+#endif
@@ -0,0 +1,215 @@
+/*
+ * This file is part of the firmware for the Andy's Workshop USB Microphone.
+ * Copyright 2021 Andy Brown. See https://andybrown.me.uk for project details.
+ * This project is open source subject to the license published on https://andybrown.me.uk.
+ */
+
+#pragma once
+
+#include <math.h>
+
+/**
+ * Native volume control with a look-ahead peak limiter, an in-tree alternative to the ST SVC
+ * library. The volume is applied as a fixed-point gain and the limiter pulls the gain down
+ * ahead of any peak that would exceed the threshold after amplification. The signal is delayed
+ * by the look-ahead length so that the gain reduction is complete by the time the peak arrives.
+ *
+ * All per-sample arithmetic is integer. The volume gain is Q20 so that it covers the full
+ * -80..+36dB range, the limiter gain is Q30 and the samples are Q31. The limiter's level
+ * detector works at 16 bit resolution, which is plenty to decide how much to reduce the gain by.
+ */
+
+class VolumeLimiter {
+
+  private:
+    static const int32_t UNITY_GAIN = 1 << 30;
+
+    int32_t _volumeGain;      // Q20
+    int32_t _limiterGain;     // Q30
+    int32_t _holdTarget;      // Q30
+    uint16_t _holdCount;
+    int32_t _threshold;       // detector level, 16 bit
+    int32_t _attack;          // Q30 smoothing coefficients
+    int32_t _release;
+    bool _mute;
+
+    int32_t *_delayLine;
+    uint16_t _lookahead;
+    uint16_t _maxLookahead;
+    uint16_t _delayIndex;
+
+  public:
+    VolumeLimiter(uint32_t sampleRate, uint16_t lookahead, uint16_t maxLookahead);
+
+    void setSampleRate(uint32_t sampleRate, uint16_t lookahead);
+    void setVolume(int16_t volume);
+    void setMute(bool mute);
+    bool isMuted() const;
+
+    uint16_t getLookahead() const;
+
+    void process(int32_t *iobuffer, uint16_t nSamples);
+};
+
+/**
+ * Constructor
+ * @param sampleRate The sample rate in Hz
+ * @param lookahead The look-ahead in samples. This is also the latency that the limiter adds.
+ * @param maxLookahead The largest look-ahead that will be passed to setSampleRate()
+ */
+
+inline VolumeLimiter::VolumeLimiter(uint32_t sampleRate, uint16_t lookahead, uint16_t maxLookahead) {
+
+  _maxLookahead = maxLookahead < lookahead ? lookahead : maxLookahead;
+  _mute = false;
+
+  _delayLine = _maxLookahead ? new int32_t[_maxLookahead] : nullptr;
+
+  // limit at -1dBFS
+
+  _threshold = 29205;
+
+  setSampleRate(sampleRate, lookahead);
+  setVolume(0);
+}
+
+/**
+ * Change the sample rate and look-ahead. The delay line and the limiter gain are reset.
+ * @param lookahead The look-ahead in samples, up to the maximum given to the constructor
+ */
+
+inline void VolumeLimiter::setSampleRate(uint32_t sampleRate, uint16_t lookahead) {
+
+  _lookahead = lookahead < _maxLookahead ? lookahead : _maxLookahead;
+  _delayIndex = 0;
+
+  if (_lookahead) {
+    memset(_delayLine, 0, _lookahead * sizeof(int32_t));
+  }
+
+  _limiterGain = _holdTarget = UNITY_GAIN;
+  _holdCount = 0;
+
+  // the attack settles to within 1% over the look-ahead period and the release time constant is 100ms
+
+  float attackSamples = _lookahead ? _lookahead / 5.0f : 1.0f;
+
+  // expm1f() keeps the precision of the small release coefficient that 1 - expf() would lose
+
+  _attack = (int32_t) (-UNITY_GAIN * expm1f(-1 / attackSamples));
+  _release = (int32_t) (-UNITY_GAIN * expm1f(-1 / (0.1f * sampleRate)));
+
+  if (_release < 1) {
+    _release = 1;
+  }
+}
+
+/**
+ * Set the volume level in 0.5dB steps. -160..72 is -80..+36dB.
+ */
+
+inline void VolumeLimiter::setVolume(int16_t volume) {
+
+  if (volume < -160) {
+    volume = -160;
+  }
+  else if (volume > 72) {
+    volume = 72;
+  }
+
+  _volumeGain = (int32_t) (powf(10, volume / 40.0f) * (1 << 20) + 0.5f);
+}
+
+/**
+ * Set the muted state. The delay line keeps running so that unmuting resumes cleanly.
+ */
+
+inline void VolumeLimiter::setMute(bool mute) {
+  _mute = mute;
+}
+
+inline bool VolumeLimiter::isMuted() const {
+  return _mute;
+}
+
+inline uint16_t VolumeLimiter::getLookahead() const {
+  return _lookahead;
+}
+
+/**
+ * Process a block of mono Q31 samples in place
+ */
+
+inline void VolumeLimiter::process(int32_t *iobuffer, uint16_t nSamples) {
+
+  int32_t gain = _limiterGain;
+
+  for (uint16_t i = 0; i < nSamples; i++) {
+
+    int32_t input = iobuffer[i];
+
+    // the 16 bit level that this sample will reach after the volume gain is applied
+
+    int64_t magnitude = input < 0 ? -(int64_t) input : input;
+    int32_t level = (int32_t) ((magnitude * _volumeGain) >> 36);
+
+    // the limiter gain needed to bring it down to the threshold
+
+    int32_t target = UNITY_GAIN;
+
+    if (level > _threshold) {
+      target = ((_threshold << 15) / level) << 15;
+    }
+
+    // hold the lowest target for the look-ahead period so that the attack has time to reach it
+
+    if (target <= _holdTarget || _holdCount == 0) {
+      _holdTarget = target;
+      _holdCount = _lookahead;
+    }
+    else {
+      target = _holdTarget;
+      _holdCount--;
+    }
+
+    // fast attack towards a lower gain, slow release back up to unity
+
+    if (target < gain) {
+      gain -= (int32_t) (((int64_t) (gain - target) * _attack) >> 30);
+    }
+    else {
+      gain += (int32_t) (((int64_t) (target - gain) * _release) >> 30);
+    }
+
+    // swap the sample with the one from the delay line
+
+    int32_t delayed = input;
+
+    if (_lookahead) {
+      delayed = _delayLine[_delayIndex];
+      _delayLine[_delayIndex] = input;
+
+      if (++_delayIndex == _lookahead) {
+        _delayIndex = 0;
+      }
+    }
+
+    // apply the combined gain and saturate. At +36dB before the limiter has caught up the
+    // product is up to 2^37 so it's clamped as a 64 bit value. SSAT only takes 32 bits and
+    // would cost the low bits of the sample to get it there.
+
+    int32_t total = (int32_t) (((int64_t) _volumeGain * gain) >> 30);
+    int64_t output = ((int64_t) delayed * total) >> 20;
+
+    if (output > INT32_MAX) {
+      output = INT32_MAX;
+    }
+    else if (output < INT32_MIN) {
+      output = INT32_MIN;
+    }
+
+    iobuffer[i] = _mute ? 0 : (int32_t) output;
+  }
+
+  _limiterGain = gain;
+}
@@ -9,6 +9,9 @@
 #include "stm32f4xx_hal.h"
 
 void Error_Handler();
+HAL_StatusTypeDef MX_I2S1_SetSampleRate(uint32_t sampleRate);
+HAL_StatusTypeDef MX_SystemClock_SetReduced(uint8_t reduced);
+uint32_t MX_EnterStopMode();
 
 #define MUTE_Pin GPIO_PIN_2
 #define MUTE_GPIO_Port GPIOA
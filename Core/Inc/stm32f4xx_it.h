@@ -15,5 +15,8 @@ void SVC_Handler();
 void DebugMon_Handler();
 void PendSV_Handler();
 void SysTick_Handler();
+void EXTI2_IRQHandler();
 void DMA2_Stream0_IRQHandler();
+void TIM7_IRQHandler();
 void OTG_FS_IRQHandler();
+void OTG_FS_WKUP_IRQHandler();
@@ -0,0 +1,38 @@
+/*
+ * This file is part of the firmware for the Andy's Workshop USB Microphone.
+ * Copyright 2021 Andy Brown. See https://andybrown.me.uk for project details.
+ * This project is open source subject to the license published on https://andybrown.me.uk.
+ */
+
+#include "Application.h"
+
+MuteButton *MuteButton::_instance = nullptr;
+
+extern "C" {
+
+/**
+ * An edge on the mute button's EXTI line, timestamped with the audio frame that the DMA is
+ * receiving. The line is enabled before the application's objects are constructed.
+ */
+
+void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin) {
+
+  if (GPIO_Pin == MUTE_Pin && MuteButton::_instance && Audio::_instance) {
+    MuteButton::_instance->edge(Audio::_instance->getFrameTime());
+  }
+}
+
+/**
+ * The mute button's debounce timer has expired. The timer is driven through its registers
+ * so there's no HAL handler to go through.
+ */
+
+void TIM7_IRQHandler() {
+
+  TIM7->SR = ~(uint32_t) TIM_SR_UIF;
+
+  if (MuteButton::_instance) {
+    MuteButton::_instance->debounced();
+  }
+}
+}
@@ -0,0 +1,36 @@
+/*
+ * This file is part of the firmware for the Andy's Workshop USB Microphone.
+ * Copyright 2021 Andy Brown. See https://andybrown.me.uk for project details.
+ * This project is open source subject to the license published on https://andybrown.me.uk.
+ */
+
+#include "Application.h"
+
+PowerManager *PowerManager::_instance = nullptr;
+
+extern "C" {
+
+/**
+ * The bus has been suspended (called from the suspend callback in usbd_conf.c). The device can
+ * be suspended before the application's objects are constructed.
+ */
+
+void Power_Suspend(uint8_t stop) {
+
+  if (PowerManager::_instance) {
+    PowerManager::_instance->suspend(stop != 0);
+  }
+}
+
+/**
+ * The bus has been resumed, or reset while it was suspended (called from the resume and reset
+ * callbacks in usbd_conf.c)
+ */
+
+void Power_Resume(uint8_t reset) {
+
+  if (PowerManager::_instance) {
+    PowerManager::_instance->resume(reset != 0);
+  }
+}
+}
@@ -18,6 +18,8 @@ static void MX_GPIO_Init();
 static void MX_DMA_Init();
 static void MX_I2S1_Init();
 static void MX_CRC_Init();
+static void MX_TIM7_Init();
+static void MX_TIM7_SetPrescaler();
 
 int main() {
 
@@ -33,11 +35,17 @@ int main() {
   // Configure the system clock */
   SystemClock_Config();
 
+#ifdef SEMIHOSTING
+  // keep the debugger connected while the USB is suspended
+  HAL_DBGMCU_EnableDBGStopMode();
+#endif
+
   // initialise the CRC unit for the SVC and GREQ audio modules
   MX_CRC_Init();
 
   // Initialize all configured peripherals
   MX_GPIO_Init();
+  MX_TIM7_Init();
   MX_DMA_Init();
   MX_I2S1_Init();
   MX_USB_DEVICE_Init();
@@ -130,6 +138,59 @@ static void MX_I2S1_Init() {
   }
 }
 
+/*
+ * Reclock I2S1 for a new sample rate while it's stopped. The microphone's 32 bit slots give a
+ * bit clock of 64.Fs, and the HAL works out the divider from the I2S kernel clock. The external
+ * 12.288MHz clock divides exactly to 16, 32 and 48kHz. 44.1kHz isn't a submultiple of it and
+ * 96kHz would need a divider of 1, which the I2S can't do, so those two run from PLLI2S:
+ *
+ *   44.1kHz: 8MHz / 8 * 429 / 4 = 107.25MHz, divider 38 = 44099.5Hz
+ *   96kHz:   8MHz / 5 * 192 / 2 = 153.6MHz, divider 25 = 96000Hz
+ */
+
+HAL_StatusTypeDef MX_I2S1_SetSampleRate(uint32_t sampleRate) {
+
+  RCC_PeriphCLKInitTypeDef PeriphClkInitStruct = { 0 };
+
+  PeriphClkInitStruct.PeriphClockSelection = RCC_PERIPHCLK_I2S_APB2;
+
+  switch (sampleRate) {
+
+  case I2S_AUDIOFREQ_44K:
+    PeriphClkInitStruct.PLLI2S.PLLI2SM = 8;
+    PeriphClkInitStruct.PLLI2S.PLLI2SN = 429;
+    PeriphClkInitStruct.PLLI2S.PLLI2SR = 4;
+    PeriphClkInitStruct.I2sApb2ClockSelection = RCC_I2SAPB2CLKSOURCE_PLLI2S;
+    hi2s1.Init.ClockSource = I2S_CLOCK_PLL;
+    break;
+
+  case I2S_AUDIOFREQ_96K:
+    PeriphClkInitStruct.PLLI2S.PLLI2SM = 5;
+    PeriphClkInitStruct.PLLI2S.PLLI2SN = 192;
+    PeriphClkInitStruct.PLLI2S.PLLI2SR = 2;
+    PeriphClkInitStruct.I2sApb2ClockSelection = RCC_I2SAPB2CLKSOURCE_PLLI2S;
+    hi2s1.Init.ClockSource = I2S_CLOCK_PLL;
+    break;
+
+  case I2S_AUDIOFREQ_16K:
+  case I2S_AUDIOFREQ_32K:
+  case I2S_AUDIOFREQ_48K:
+    PeriphClkInitStruct.I2sApb2ClockSelection = RCC_I2SAPB2CLKSOURCE_EXT;
+    hi2s1.Init.ClockSource = I2S_CLOCK_EXTERNAL;
+    break;
+
+  default:
+    return HAL_ERROR;
+  }
+
+  if (HAL_RCCEx_PeriphCLKConfig(&PeriphClkInitStruct) != HAL_OK) {
+    return HAL_ERROR;
+  }
+
+  hi2s1.Init.AudioFreq = sampleRate;
+  return HAL_I2S_Init(&hi2s1);
+}
+
 static void MX_DMA_Init() {
 
   /* DMA controller clock enable */
@@ -140,6 +201,11 @@ static void MX_DMA_Init() {
 
   HAL_NVIC_SetPriority(DMA2_Stream0_IRQn, 0, 0);
   HAL_NVIC_EnableIRQ(DMA2_Stream0_IRQn);
+
+  /* the audio processing is deferred from the DMA interrupt to PendSV (see usbd_audio_if.cpp)
+     at the lowest priority so the USB and DMA interrupts can preempt it */
+
+  HAL_NVIC_SetPriority(PendSV_IRQn, 15, 0);
 }
 
 static void MX_GPIO_Init() {
@@ -156,7 +222,7 @@ static void MX_GPIO_Init() {
 
   /*Configure GPIO pin : MUTE_Pin */
   GPIO_InitStruct.Pin = MUTE_Pin;
-  GPIO_InitStruct.Mode = GPIO_MODE_INPUT;
+  GPIO_InitStruct.Mode = GPIO_MODE_IT_RISING_FALLING;
   GPIO_InitStruct.Pull = GPIO_PULLUP;
   HAL_GPIO_Init(MUTE_GPIO_Port, &GPIO_InitStruct);
 
@@ -175,6 +241,103 @@ static void MX_GPIO_Init() {
   GPIO_InitStruct.Alternate = GPIO_AF5_SPI1;
   HAL_GPIO_Init(GPIOC, &GPIO_InitStruct);
 
+  /* EXTI interrupt init. The mute button's edge and debounce timer interrupts share a
+     priority below the DMA and USB (see Button.h) */
+
+  HAL_NVIC_SetPriority(EXTI2_IRQn, 1, 0);
+  HAL_NVIC_EnableIRQ(EXTI2_IRQn);
+}
+
+/**
+ * TIM7 is the mute button's debounce timer. It counts at 10kHz and stops itself at the update
+ * event. The HAL TIM driver isn't used because the button only ever writes the reload value
+ * and starts it.
+ */
+
+static void MX_TIM7_Init() {
+
+  __HAL_RCC_TIM7_CLK_ENABLE();
+
+  /* only an overflow sets the update flag so the prescaler can be loaded without an interrupt */
+
+  TIM7->CR1 = TIM_CR1_OPM | TIM_CR1_URS;
+  MX_TIM7_SetPrescaler();
+  TIM7->SR = 0;
+  TIM7->DIER = TIM_DIER_UIE;
+
+  HAL_NVIC_SetPriority(TIM7_IRQn, 1, 0);
+  HAL_NVIC_EnableIRQ(TIM7_IRQn);
+}
+
+/**
+ * Set TIM7 to count at 10kHz from the current APB1 clock. APB1 is always divided so the timer
+ * clock is twice PCLK1. The update event loads the prescaler.
+ */
+
+static void MX_TIM7_SetPrescaler() {
+  TIM7->PSC = HAL_RCC_GetPCLK1Freq() * 2 / 10000 - 1;
+  TIM7->EGR = TIM_EGR_UG;
+}
+
+/**
+ * Run the core and the buses at a quarter of their speed while there's no audio to process,
+ * or back at full speed. Only the AHB prescaler changes so the PLLs that clock the USB and the
+ * I2S run on undisturbed. 45MHz is above 32MHz so the USB core's turnaround time, which was
+ * set for the full speed clock, is still right. SysTick is reprogrammed by the HAL.
+ */
+
+HAL_StatusTypeDef MX_SystemClock_SetReduced(uint8_t reduced) {
+
+  RCC_ClkInitTypeDef RCC_ClkInitStruct = { 0 };
+  HAL_StatusTypeDef status;
+
+  RCC_ClkInitStruct.ClockType = RCC_CLOCKTYPE_HCLK | RCC_CLOCKTYPE_PCLK1 | RCC_CLOCKTYPE_PCLK2;
+  RCC_ClkInitStruct.AHBCLKDivider = reduced ? RCC_SYSCLK_DIV4 : RCC_SYSCLK_DIV1;
+  RCC_ClkInitStruct.APB1CLKDivider = RCC_HCLK_DIV4;
+  RCC_ClkInitStruct.APB2CLKDivider = RCC_HCLK_DIV2;
+
+  if ((status = HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLASH_LATENCY_5)) == HAL_OK) {
+    MX_TIM7_SetPrescaler();
+  }
+
+  return status;
+}
+
+/**
+ * Stop the core and the clocks while the USB is suspended (called from the main loop with the
+ * interrupts masked). The USB wakeup EXTI line is the one that's meant to end it so the mute
+ * button's interrupt is disabled until the clocks are back. The core wakes on the 16MHz HSI
+ * with the PLLs off and the I2S clock selection reset, so SystemClock_Config() and the I2S
+ * clock for the current sample rate are run again. The core doesn't stop at all if an
+ * interrupt was already pending, and then the clocks are still running.
+ * @return The microseconds taken to restart the clocks, timed with the cycle counter at the HSI
+ *         rate. The few cycles after the switch to the PLL make it a slight overestimate.
+ */
+
+uint32_t MX_EnterStopMode() {
+
+  uint32_t start, elapsed;
+
+  HAL_NVIC_DisableIRQ(EXTI2_IRQn);
+  HAL_PWR_EnterSTOPMode(PWR_LOWPOWERREGULATOR_ON, PWR_STOPENTRY_WFI);
+
+  start = DWT->CYCCNT;
+
+  if (__HAL_RCC_GET_SYSCLK_SOURCE() != RCC_SYSCLKSOURCE_STATUS_PLLCLK) {
+
+    SystemClock_Config();
+
+    if (MX_I2S1_SetSampleRate(hi2s1.Init.AudioFreq) != HAL_OK) {
+      Error_Handler();
+    }
+  }
+
+  elapsed = (DWT->CYCCNT - start) / (HSI_VALUE / 1000000);
+
+  MX_TIM7_SetPrescaler();
+  HAL_NVIC_EnableIRQ(EXTI2_IRQn);
+
+  return elapsed;
 }
 
 __attribute__((optimize("O0"))) void Error_Handler() {
@@ -58,13 +58,6 @@ void SVC_Handler() {
 void DebugMon_Handler() {
 }
 
-/**
- * @brief This function handles Pendable request for system service.
- */
-
-void PendSV_Handler() {
-}
-
 /**
  * @brief This function handles System tick timer.
  */
@@ -87,6 +80,14 @@ void DMA2_Stream0_IRQHandler() {
   HAL_DMA_IRQHandler(&hdma_spi1_rx);
 }
 
+/**
+ * @brief This function handles EXTI line2 interrupt, the mute button.
+ */
+
+void EXTI2_IRQHandler() {
+  HAL_GPIO_EXTI_IRQHandler(MUTE_Pin);
+}
+
 /**
  * @brief This function handles USB On The Go FS global interrupt.
  */
@@ -94,3 +95,14 @@ void DMA2_Stream0_IRQHandler() {
 void OTG_FS_IRQHandler() {
   HAL_PCD_IRQHandler(&hpcd_USB_OTG_FS);
 }
+
+/**
+ * @brief This function handles the USB On The Go FS wakeup interrupt through EXTI line 18.
+ * It's the first to run when the host resumes a suspended bus, after the main loop has
+ * restarted the clocks. The core needs its PHY clock to see the resume.
+ */
+
+void OTG_FS_WKUP_IRQHandler() {
+  __HAL_PCD_UNGATE_PHYCLOCK(&hpcd_USB_OTG_FS);
+  __HAL_USB_OTG_FS_WAKEUP_EXTI_CLEAR_FLAG();
+}
@@ -0,0 +1,178 @@
+/*
+ * This file is part of the firmware for the Andy's Workshop USB Microphone.
+ * Copyright 2021 Andy Brown. See https://andybrown.me.uk for project details.
+ * This project is open source subject to the license published on https://andybrown.me.uk.
+ */
+
+/*
+ * Host benchmark for the Audio::sendData path. A synthetic I2S DMA stream drives the real
+ * application classes and the time taken by each half-buffer callback is reported.
+ *
+ *   build-host/audio-bench [seconds] [bits] [rate]
+ *
+ * bits is the USB subframe resolution, 16 (the default), 24 or 32. rate is one of the sampling
+ * frequencies that the host can select, 48000 by default. The dither modes are then compared
+ * on their own at 16 bits.
+ */
+
+#include "Application.h"
+#include "UsbCapture.h"
+#include "I2sDmaProducer.h"
+
+/**
+ * The requantisation that Dither replaced, for comparison
+ */
+
+static void requantiseRand(const int32_t *samples, uint8_t *data_out, uint16_t nSamples) {
+
+  int16_t *dest = reinterpret_cast<int16_t*>(data_out);
+
+  for (uint16_t i = 0; i < nSamples; i++) {
+    *dest++ = __QADD(*samples++, rand() & 0xffff) >> 16;
+  }
+}
+
+/**
+ * Requantise a 1kHz tone at -80dBFS to 16 bits with each dither mode. The time per block and
+ * the level of the requantisation error are printed, the error both over the whole band and
+ * through an 8 sample moving average that keeps roughly the lowest eighth of the band.
+ */
+
+static void benchDither(uint32_t sampleRate) {
+
+  const uint32_t blocks = 1000;
+  const uint16_t nSamples = sampleRate * MIC_MS_PER_PACKET / 2000;
+
+  int32_t *samples = new int32_t[nSamples];
+  int16_t *output = new int16_t[nSamples];
+  double phase = 0;
+
+  printf("16 bit dither, 1kHz at -80dBFS:\n");
+
+  for (int mode = -1; mode <= Dither::NOISE_SHAPED; mode++) {
+
+    Dither dither;
+    uint64_t cycles = 0;
+    double totalPower = 0, lowPower = 0;
+    int64_t window[8] = { 0 };
+    int64_t windowSum = 0;
+    uint32_t count = 0;
+
+    if (mode >= 0) {
+      dither.setMode((Dither::Mode) mode);
+    }
+
+    for (uint32_t b = 0; b < blocks; b++) {
+
+      for (uint16_t i = 0; i < nSamples; i++) {
+        samples[i] = (int32_t) lrint(2147483647.0 * pow(10.0, -80 / 20.0) * sin(phase));
+        phase += 2 * M_PI * 1000 / sampleRate;
+      }
+
+      uint32_t start = DWT->CYCCNT;
+
+      if (mode < 0) {
+        requantiseRand(samples, reinterpret_cast<uint8_t*>(output), nSamples);
+      } else {
+        dither.requantise(samples, reinterpret_cast<uint8_t*>(output), nSamples, 2);
+      }
+
+      cycles += DWT->CYCCNT - start;
+
+      for (uint16_t i = 0; i < nSamples; i++, count++) {
+
+        int64_t error = ((int64_t) output[i] << 16) - samples[i];
+
+        windowSum += error - window[count & 7];
+        window[count & 7] = error;
+
+        totalPower += (double) error * error;
+        lowPower += (double) (windowSum / 8) * (windowSum / 8);
+      }
+    }
+
+    printf("  %-11s %8.2fus per block  noise %6.1fdBFS  low band %6.1fdBFS\n",
+        mode < 0 ? "rand()" : Dither::getModeName((Dither::Mode) mode), cycles / 1000.0 / blocks,
+        10 * log10(totalPower / count / 4.611686e18), 10 * log10(lowPower / count / 4.611686e18));
+  }
+
+  delete[] samples;
+  delete[] output;
+}
+
+int main(int argc, char *argv[]) {
+
+  uint32_t seconds = argc > 1 ? atoi(argv[1]) : 10;
+  uint32_t bits = argc > 2 ? atoi(argv[2]) : 16;
+  uint32_t sampleRate = argc > 3 ? atoi(argv[3]) : MIC_SAMPLE_FREQUENCY;
+
+  if (bits != 16 && bits != 24 && bits != 32) {
+    fprintf(stderr, "usage: audio-bench [seconds] [16|24|32] [rate]\n");
+    return 1;
+  }
+
+  // the mute button is pulled up, i.e. not pressed
+
+  HAL_GPIO_WritePin(MUTE_GPIO_Port, MUTE_Pin, GPIO_PIN_SET);
+  MUTE_GPIO_Port->IDR |= MUTE_Pin;
+
+  // the same objects that Program owns
+
+  MuteButton muteButton;
+  LiveLed liveLed;
+  GraphicEqualizer graphicEqualiser;
+  VolumeControl volumeControl;
+  Audio audio(muteButton, liveLed, graphicEqualiser, volumeControl);
+
+  UsbCapture capture;
+
+  // 1kHz at -20dBFS with a -70dBFS noise floor
+
+  SineSource source(1000, sampleRate, -20, -70);
+  I2sDmaProducer producer(hi2s1, source);
+  PacketTimer timer;
+
+  // the host selects the format and rate and starts the stream exactly as the USB class driver does
+
+  capture.setSubframeSize(bits / 8);
+
+  if (USBD_AUDIO_fops.Init(sampleRate, bits, MIC_NUM_CHANNELS) != USBD_OK) {
+    fprintf(stderr, "unsupported sample rate: %u\n", sampleRate);
+    return 1;
+  }
+
+  if (USBD_AUDIO_fops.Record() != USBD_OK) {
+    fprintf(stderr, "failed to start the audio stream\n");
+    return 1;
+  }
+
+  uint32_t halves = seconds * 1000 / (MIC_MS_PER_PACKET / 2);
+  uint32_t transferred = producer.run(halves, timer);
+
+  USBD_AUDIO_fops.Stop();
+
+  printf("%u ms of audio, %u %u bit samples at %uHz sent to USB\n", transferred * (MIC_MS_PER_PACKET / 2),
+      (unsigned) capture.getSamples().size(), bits, sampleRate);
+
+  timer.report(stdout, (MIC_MS_PER_PACKET / 2) * 1000.0);
+
+  // the firmware's own per-stage profile. The host cycle counter runs at 1GHz.
+
+  ProfilerReport report;
+  audio.getProfiler().getReport(report);
+
+  printf("  %u blocks, %u overruns\n", (unsigned) report.blocks, (unsigned) report.overruns);
+
+  for (uint8_t i = 0; i < Profiler::STAGE_COUNT; i++) {
+    printf("  %-10s min: %8.2fus  mean: %8.2fus  max: %8.2fus\n", Profiler::getStageName((Profiler::Stage) i),
+        report.stages[i].min / 1000.0, report.stages[i].mean / 1000.0, report.stages[i].max / 1000.0);
+  }
+
+  if (capture.getSamples().size() != transferred * (sampleRate * MIC_MS_PER_PACKET / 1000 / 2)) {
+    fprintf(stderr, "unexpected number of samples sent to USB\n");
+    return 1;
+  }
+
+  benchDither(sampleRate);
+  return 0;
+}
@@ -0,0 +1,457 @@
+/*
+ * This file is part of the firmware for the Andy's Workshop USB Microphone.
+ * Copyright 2021 Andy Brown. See https://andybrown.me.uk for project details.
+ * This project is open source subject to the license published on https://andybrown.me.uk.
+ */
+
+/*
+ * Drives the real USB audio class driver (usbd_audio_in.c) through repeated stream start and
+ * stop cycles in every streaming format and sampling frequency, the way the host and the
+ * audio interface would. The heap functions are wrapped at link time and the check fails if
+ * the driver calls any of them after it has been configured. Every isochronous packet is also
+ * checked to make sure that the FIFO delivers the transfers intact and in order, whether they
+ * were copied in with USBD_AUDIO_Data_Transfer or written in place through a reservation.
+ * Finally the sample clock is run fast and slow against the host's frames for a minute each
+ * to check that the asynchronous packet sizing holds the FIFO level close to its target, and
+ * the latency from the capture of each sample to its packet being handed to the USB core is
+ * reported. A stream is also suspended and resumed to check that it restarts cleanly and
+ * in time. The transfers are the size of the audio interface's processing blocks, so a
+ * 'make LOW_LATENCY=1' build measures the low latency configuration.
+ *
+ *   build-host/usb-stream-check [cycles]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern "C" {
+#include "usbd_audio_if.h"
+}
+
+/*
+ * Heap calls made by the driver. The linker redirects its malloc etc. to these.
+ */
+
+static uint32_t heapCalls;
+
+extern "C" {
+
+void *__real_malloc(size_t size);
+void __real_free(void *ptr);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+  heapCalls++;
+  return __real_malloc(size);
+}
+
+void __wrap_free(void *ptr) {
+  heapCalls++;
+  __real_free(ptr);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size) {
+  heapCalls++;
+  return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+  heapCalls++;
+  return __real_realloc(ptr, size);
+}
+
+}
+
+/**
+ * Simulated time in microseconds, the start of the recording and the sample clock rate
+ */
+
+static double now;
+static double recordStart;
+static double sampleRate;
+static uint32_t sampleCount;
+static double firstTransfer;
+
+/**
+ * The isochronous IN endpoint as seen by the host. Samples are a running count so any lost,
+ * repeated or corrupt data shows up as a break in the sequence. The silence sent while a
+ * stream starts up is skipped. Sample n was captured (n - 1) / sampleRate after the start of
+ * the recording so the time that it reaches the endpoint gives its latency.
+ */
+
+struct Endpoint {
+    uint8_t subframeSize;
+    uint32_t expected;
+    bool started;
+    uint32_t first;
+    double firstTime;
+    uint32_t packets;
+    uint32_t errors;
+    double latencyTotal;
+    double latencyMax;
+    uint32_t samples;
+};
+
+static Endpoint endpoint;
+static bool recording;
+
+/*
+ * USB core and low level stand-ins
+ */
+
+extern "C" {
+
+USBD_StatusTypeDef USBD_LL_OpenEP(USBD_HandleTypeDef *pdev, uint8_t ep_addr, uint8_t ep_type, uint16_t ep_mps) {
+  return USBD_OK;
+}
+
+USBD_StatusTypeDef USBD_LL_CloseEP(USBD_HandleTypeDef *pdev, uint8_t ep_addr) {
+  return USBD_OK;
+}
+
+USBD_StatusTypeDef USBD_LL_FlushEP(USBD_HandleTypeDef *pdev, uint8_t ep_addr) {
+  return USBD_OK;
+}
+
+USBD_StatusTypeDef USBD_LL_Transmit(USBD_HandleTypeDef *pdev, uint8_t ep_addr, uint8_t *pbuf, uint32_t size) {
+
+  uint32_t mask = endpoint.subframeSize == 4 ? 0xffffffff : (1U << (8 * endpoint.subframeSize)) - 1;
+
+  endpoint.packets++;
+
+  // only the data sent while the interface is recording is meaningful
+
+  if (!recording) {
+    return USBD_OK;
+  }
+
+  for (uint32_t i = 0; i + endpoint.subframeSize <= size; i += endpoint.subframeSize) {
+
+    uint32_t sample = 0;
+
+    for (uint8_t j = 0; j < endpoint.subframeSize; j++) {
+      sample |= (uint32_t) pbuf[i + j] << (8 * j);
+    }
+
+    if (!endpoint.started) {
+      if (sample == 0) {
+        continue;
+      }
+      endpoint.started = true;
+      endpoint.expected = sample;
+      endpoint.first = sample;
+      endpoint.firstTime = now;
+    }
+    else if (sample != (endpoint.expected & mask)) {
+      endpoint.errors++;
+      endpoint.expected = (endpoint.expected & ~mask) | sample;
+    }
+
+    // the sample has been captured by the end of its sample period
+
+    double latency = now - (recordStart + endpoint.expected * 1e6 / sampleRate);
+
+    endpoint.latencyTotal += latency;
+    endpoint.latencyMax = latency > endpoint.latencyMax ? latency : endpoint.latencyMax;
+    endpoint.samples++;
+    endpoint.expected++;
+  }
+
+  return USBD_OK;
+}
+
+USBD_StatusTypeDef USBD_CtlSendData(USBD_HandleTypeDef *pdev, uint8_t *pbuf, uint32_t len) {
+  return USBD_OK;
+}
+
+static uint8_t *ctlRxBuffer;
+
+USBD_StatusTypeDef USBD_CtlPrepareRx(USBD_HandleTypeDef *pdev, uint8_t *pbuf, uint32_t len) {
+  ctlRxBuffer = pbuf;
+  return USBD_OK;
+}
+
+void USBD_CtlError(USBD_HandleTypeDef *pdev, USBD_SetupReqTypedef *req) {
+  fprintf(stderr, "request stalled: bmRequest 0x%02x bRequest 0x%02x\n", req->bmRequest, req->bRequest);
+  exit(1);
+}
+
+}
+
+/*
+ * The audio interface. Record and Stop are the only calls that matter here.
+ */
+
+static int8_t Itf_Init(uint32_t AudioFreq, uint32_t BitRes, uint32_t ChnlNbr) {
+  return USBD_OK;
+}
+
+static int8_t Itf_DeInit(uint32_t options) {
+  return USBD_OK;
+}
+
+static int8_t Itf_Record() {
+  recording = true;
+  recordStart = now;
+  sampleCount = 0;
+  return USBD_OK;
+}
+
+static int8_t Itf_Stop() {
+  recording = false;
+  return USBD_OK;
+}
+
+static int8_t Itf_None() {
+  return USBD_OK;
+}
+
+static int8_t Itf_VolumeCtl(int16_t Volume) {
+  return USBD_OK;
+}
+
+static int8_t Itf_Command(uint8_t cmd) {
+  return USBD_OK;
+}
+
+static uint32_t Itf_GetSampleCount() {
+  if (recording) {
+    sampleCount = (uint32_t) ((now - recordStart) * sampleRate / 1e6);
+  }
+  return sampleCount;
+}
+
+static USBD_AUDIO_ItfTypeDef itf = { Itf_Init, Itf_DeInit, Itf_Record, Itf_VolumeCtl, Itf_Command, nullptr, Itf_Stop,
+    Itf_None, Itf_None, Itf_Command, nullptr, nullptr, Itf_GetSampleCount };
+
+/**
+ * Host requests
+ */
+
+static void setInterface(USBD_HandleTypeDef &dev, uint8_t alt) {
+
+  USBD_SetupReqTypedef req = { 0x01, USB_REQ_SET_INTERFACE, alt, 1, 0 };
+  USBD_AUDIO.Setup(&dev, &req);
+}
+
+static void setSamplingFrequency(USBD_HandleTypeDef &dev, uint32_t frequency) {
+
+  USBD_SetupReqTypedef req = { 0x22, AUDIO_REQ_SET_CUR, AUDIO_SAMPLING_FREQ_CONTROL << 8, AUDIO_IN_EP, 3 };
+  USBD_AUDIO.Setup(&dev, &req);
+
+  ctlRxBuffer[0] = frequency;
+  ctlRxBuffer[1] = frequency >> 8;
+  ctlRxBuffer[2] = frequency >> 16;
+  USBD_AUDIO.EP0_RxReady(&dev);
+}
+
+/**
+ * Stream for a number of milliseconds. The host starts a frame every 1ms and polls the
+ * endpoint. The sample clock runs at the nominal frequency adjusted by 'ppm' and the audio
+ * interface hands over a block of samples whenever it has one, alternately by copy and in place.
+ * The lowest and highest FIFO levels, in samples, are returned and the time of the first
+ * transfer is left in firstTransfer.
+ */
+
+static void stream(USBD_HandleTypeDef &dev, uint32_t frequency, uint8_t subframeSize, uint32_t ms, double ppm,
+    uint32_t &counter, uint32_t &minLevel, uint32_t &maxLevel) {
+
+  static uint8_t copy[AUDIO_IN_MAX_TRANSFER_SIZE];
+  const AUDIO_FifoTypeDef &fifo = static_cast<USBD_AUDIO_HandleTypeDef*>(dev.pClassData)->fifo;
+  uint16_t samples = frequency * MIC_MS_PER_PACKET / 2000;
+  uint32_t transfers = 0;
+  bool started = false;
+
+  sampleRate = frequency * (1 + ppm / 1e6);
+  minLevel = UINT32_MAX;
+  maxLevel = 0;
+
+  for (uint32_t i = 0; i < ms; i++) {
+
+    USBD_AUDIO.SOF(&dev);
+    USBD_AUDIO.DataIn(&dev, AUDIO_IN_EP & 0x7f);
+
+    if (started && !recording) {
+      fprintf(stderr, "%uHz %+.0fppm: the stream stopped after %ums\n", frequency, ppm, i);
+      exit(1);
+    }
+
+    if (transfers > 1) {
+      uint32_t level = (fifo.head - fifo.tail) / subframeSize;
+      minLevel = level < minLevel ? level : minLevel;
+      maxLevel = level > maxLevel ? level : maxLevel;
+    }
+
+    // run the interface up to the start of the next frame
+
+    now += 1000;
+
+    while (recording && (now - recordStart) * sampleRate / 1e6 >= (transfers + 1) * samples) {
+
+      bool inPlace = transfers++ % 2 == 1;
+      uint8_t *transfer = inPlace ? USBD_AUDIO_Reserve_Transfer(&dev, samples) : copy;
+
+      if (!started) {
+        firstTransfer = now;
+      }
+      started = true;
+
+      if (!transfer) {
+        fprintf(stderr, "reservation of %u samples failed\n", samples);
+        exit(1);
+      }
+
+      for (uint16_t j = 0; j < samples; j++, counter++) {
+        for (uint8_t k = 0; k < subframeSize; k++) {
+          transfer[j * subframeSize + k] = counter >> (8 * k);
+        }
+      }
+
+      uint8_t status = inPlace ? USBD_AUDIO_Commit_Transfer(&dev, samples) : USBD_AUDIO_Data_Transfer(&dev, copy, samples);
+
+      if (status != USBD_OK) {
+        fprintf(stderr, "transfer of %u samples failed\n", samples);
+        exit(1);
+      }
+    }
+  }
+}
+
+/**
+ * Stop sending data and let the driver notice the underrun, as it does when the DMA stops
+ */
+
+static void drain(USBD_HandleTypeDef &dev) {
+
+  for (uint32_t i = 0; i < 1000 && recording; i++) {
+    USBD_AUDIO.SOF(&dev);
+    USBD_AUDIO.DataIn(&dev, AUDIO_IN_EP & 0x7f);
+    now += 1000;
+  }
+
+  if (recording) {
+    fprintf(stderr, "the stream did not stop\n");
+    exit(1);
+  }
+}
+
+int main(int argc, char *argv[]) {
+
+  static const uint32_t frequencies[] = { 16000, 32000, 44100, 48000, 96000 };
+  static const uint8_t subframeSizes[AUDIO_ALT_SETTING_COUNT] = { 2, 3, 4 };
+
+  uint32_t cycles = argc > 1 ? atoi(argv[1]) : 10;
+  uint32_t streams = 0;
+  int failures = 0;
+
+  // configure the device, as usb_device.c and the USB core do at enumeration
+
+  USBD_HandleTypeDef dev;
+  memset(&dev, 0, sizeof(dev));
+
+  USBD_AUDIO_Init_Microphone_Descriptor(&dev, 48000, 1);
+  USBD_AUDIO_RegisterInterface(&dev, &itf);
+  USBD_AUDIO.Init(&dev, 0);
+
+  heapCalls = 0;
+
+  for (uint32_t cycle = 0; cycle < cycles; cycle++) {
+    for (uint8_t alt = 1; alt <= AUDIO_ALT_SETTING_COUNT; alt++) {
+      for (uint32_t frequency : frequencies) {
+
+        memset(&endpoint, 0, sizeof(endpoint));
+        endpoint.subframeSize = subframeSizes[alt - 1];
+
+        setInterface(dev, alt);
+        setSamplingFrequency(dev, frequency);
+
+        // the counter starts at 1 so that the data can be told apart from the start-up silence
+
+        uint32_t counter = 1, minLevel, maxLevel;
+
+        stream(dev, frequency, endpoint.subframeSize, 1000, 0, counter, minLevel, maxLevel);
+        drain(dev);
+        setInterface(dev, 0);
+
+        if (endpoint.errors || !endpoint.started) {
+          fprintf(stderr, "%u bit %uHz: %u packets, %u out of sequence samples\n", endpoint.subframeSize * 8, frequency,
+              endpoint.packets, endpoint.errors);
+          failures++;
+        }
+        streams++;
+      }
+    }
+  }
+
+  // a minute each of a sample clock that's fast and slow by more than any crystal should be.
+  // Each block swings the level by its own size so it should stay between the lead, less a
+  // packet for the rounding of the packet sizes, and the lead plus one block and two packets.
+
+  static const double drifts[] = { 500, -500 };
+  const uint32_t lead = 48000 * AUDIO_IN_LEAD_MS / 1000;
+  const uint32_t block = 48000 * MIC_MS_PER_PACKET / 2000;
+
+  for (double ppm : drifts) {
+
+    uint32_t counter = 1, minLevel, maxLevel;
+
+    memset(&endpoint, 0, sizeof(endpoint));
+    endpoint.subframeSize = subframeSizes[0];
+
+    setInterface(dev, 1);
+    setSamplingFrequency(dev, 48000);
+    stream(dev, 48000, endpoint.subframeSize, 60000, ppm, counter, minLevel, maxLevel);
+    drain(dev);
+    setInterface(dev, 0);
+
+    bool ok = !endpoint.errors && minLevel + 48 >= lead && maxLevel <= lead + block + 96;
+
+    printf("48000Hz %+.0fppm, %ums blocks: FIFO level %u to %u samples, latency mean %.2fms max %.2fms%s\n", ppm,
+        MIC_MS_PER_PACKET / 2, minLevel, maxLevel, endpoint.latencyTotal / endpoint.samples / 1000,
+        endpoint.latencyMax / 1000, ok ? "" : " FAILED");
+    failures += ok ? 0 : 1;
+  }
+
+  // suspend a stream and resume it. The host drives resume for 20ms and waits 10ms more before
+  // it starts the frames again and polls the endpoint, which restarts the stream. The first
+  // sample after the resume must be the first one captured after it, and the first block must
+  // be handed over within the target.
+
+  {
+    uint32_t counter = 1, minLevel, maxLevel;
+
+    memset(&endpoint, 0, sizeof(endpoint));
+    endpoint.subframeSize = subframeSizes[0];
+
+    setInterface(dev, 1);
+    setSamplingFrequency(dev, 48000);
+    stream(dev, 48000, endpoint.subframeSize, 500, 0, counter, minLevel, maxLevel);
+
+    USBD_AUDIO_Suspend(&dev);
+    bool stopped = !recording;
+
+    now += 100000;
+
+    double wakeup = now;
+    uint32_t resumeCounter = counter;
+
+    now += 30000;
+    endpoint.started = false;
+
+    stream(dev, 48000, endpoint.subframeSize, 500, 0, counter, minLevel, maxLevel);
+    drain(dev);
+    setInterface(dev, 0);
+
+    double latency = (firstTransfer - wakeup) / 1000;
+    bool ok = stopped && !endpoint.errors && endpoint.first == resumeCounter && latency <= MIC_RESUME_TARGET_MS;
+
+    printf("suspend and resume: first block %.0fms and first sample %.0fms after the wakeup, target %ums%s\n", latency,
+        (endpoint.firstTime - wakeup) / 1000, MIC_RESUME_TARGET_MS, ok ? "" : " FAILED");
+    failures += ok ? 0 : 1;
+  }
+
+  printf("%u streams started and stopped, %u heap calls, %d streams with errors\n", streams, heapCalls, failures);
+  return heapCalls || failures ? 1 : 0;
+}
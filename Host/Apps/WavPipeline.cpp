@@ -0,0 +1,574 @@
+/*
+ * This file is part of the firmware for the Andy's Workshop USB Microphone.
+ * Copyright 2021 Andy Brown. See https://andybrown.me.uk for project details.
+ * This project is open source subject to the license published on https://andybrown.me.uk.
+ */
+
+/*
+ * Offline runner for the firmware's audio processing chain. A WAV file is packed into the
+ * 64 bit I2S frames that Audio::sendData consumes, pushed through the real chain by the
+ * synthetic DMA producer and whatever is committed to the USB FIFO is written out as
+ * a WAV in the selected USB streaming format. The chain runs at the sample rate of the input
+ * when it's one that the device offers, otherwise at MIC_SAMPLE_FREQUENCY.
+ *
+ *   build-host/wav-pipeline [--volume <n>] [--eq <b0,...,b9>] [--bits <n>] [--highpass <order,hz>] [--gate <t,r,a,h,r>] [--dither <mode>] [--fade <ms>] [--mute <ms,...>] [--timing <csv>] <in.wav> <out.wav>
+ *   build-host/wav-pipeline --check <manifest> [--update]
+ *
+ * --volume is in 0.5dB steps (-160..72) as used by VolumeControl, --eq is a list of ten band
+ * gains in dB (-12..12) and --bits is the USB subframe resolution (16, 24 or 32, default 16)
+ * that the host would select with the alternate setting. --highpass sets the order (0 for off,
+ * 1 or 2) and the cutoff of the DC-blocking filter, 1,20 by default. --gate enables the noise
+ * gate with its threshold (dBFS), range (dB), attack, hold and release (ms) and optionally a 1
+ * to hold it open while there's speech. The share of the input detected as speech is printed. --dither is rectangular, triangular
+ * (the default) or shaped. --fade sets the length of the gain ramp and --mute lists the times
+ * at which the host toggles mute, rounded down to a whole packet. With --mute the output is
+ * compared with an unmuted run and the command fails if a transition steps by more than the
+ * ramp allows, i.e. if it would click. --check runs every entry in a manifest of golden inputs and output
+ * hashes and fails if any output is not bit-exact. --update rewrites the hashes instead.
+ */
+
+#include <string>
+#include <vector>
+#include <math.h>
+#include <stdio.h>
+#include "Application.h"
+#include "UsbCapture.h"
+#include "I2sDmaProducer.h"
+#include "WavFile.h"
+
+/**
+ * The user-adjustable parts of the processing chain
+ */
+
+struct PipelineSettings {
+    int16_t volume;
+    int8_t bands[10];
+    uint8_t bits;
+    uint32_t sampleRate;
+    HighPassSettings highPass;
+    NoiseGateSettings gate;
+    Dither::Mode dither;
+    uint16_t fadeTime;
+    std::vector<uint32_t> muteTimes;    // ms
+};
+
+/**
+ * FNV-1a over the output samples in the little-endian USB subframe format
+ */
+
+static uint64_t hashSamples(const std::vector<int32_t> &samples, uint8_t bits) {
+
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  uint8_t bytes = bits / 8;
+
+  for (int32_t sample : samples) {
+    for (uint8_t i = 0; i < bytes; i++) {
+      hash ^= (uint8_t) ((uint32_t) sample >> (32 - 8 * (bytes - i)));
+      hash *= 0x100000001b3ULL;
+    }
+  }
+  return hash;
+}
+
+/**
+ * The streaming formats of the USB alternate settings
+ */
+
+static bool validBits(int bits) {
+  return bits == 16 || bits == 24 || bits == 32;
+}
+
+/**
+ * The sampling frequencies in the format descriptor
+ */
+
+static bool validSampleRate(uint32_t sampleRate) {
+  return sampleRate == 16000 || sampleRate == 32000 || sampleRate == 44100 || sampleRate == 48000
+      || sampleRate == 96000;
+}
+
+/**
+ * The high-pass filter as <order>,<cutoff>
+ */
+
+static bool parseHighPass(const char *str, HighPassSettings &highPass) {
+
+  unsigned o, hz;
+  char end;
+
+  if (sscanf(str, "%u,%u%c", &o, &hz, &end) != 2 || o > UINT8_MAX || hz > UINT16_MAX) {
+    return false;
+  }
+
+  highPass.order = o;
+  highPass.reserved = 0;
+  highPass.cutoff = hz;
+  return HighPassFilter::validate(highPass);
+}
+
+/**
+ * The noise gate as <threshold>,<range>,<attack>,<hold>,<release>[,<voice keyed>]
+ */
+
+static bool parseGate(const char *str, NoiseGateSettings &gate) {
+
+  int threshold, range;
+  unsigned attack, hold, release, voiceKeyed = 0;
+  char end;
+  int fields = sscanf(str, "%d,%d,%u,%u,%u,%u%c", &threshold, &range, &attack, &hold, &release, &voiceKeyed, &end);
+
+  if (fields != 5 && fields != 6) {
+    return false;
+  }
+
+  gate.enabled = 1;
+  gate.threshold = threshold < -128 ? -128 : threshold > 127 ? 127 : threshold;
+  gate.range = range < -128 ? -128 : range > 127 ? 127 : range;
+  gate.voiceKeyed = voiceKeyed > 1 ? 2 : voiceKeyed;
+  gate.attack = attack > UINT16_MAX ? UINT16_MAX : attack;
+  gate.hold = hold > UINT16_MAX ? UINT16_MAX : hold;
+  gate.release = release > UINT16_MAX ? UINT16_MAX : release;
+
+  return NoiseGate::validate(gate);
+}
+
+/**
+ * The dither modes by name
+ */
+
+static bool parseDither(const char *str, Dither::Mode &mode) {
+
+  for (int i = Dither::RECTANGULAR; i <= Dither::NOISE_SHAPED; i++) {
+    if (!strcmp(str, Dither::getModeName((Dither::Mode) i))) {
+      mode = (Dither::Mode) i;
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Run the input through a freshly constructed processing chain
+ * @param voiceActivity The percentage of 10ms frames that the voice activity detector marked as speech
+ */
+
+static bool runPipeline(const std::vector<int32_t> &input, const PipelineSettings &settings,
+    std::vector<int32_t> &output, PacketTimer &timer, double &voiceActivity) {
+
+  // the mute button is pulled up, i.e. not pressed
+
+  MUTE_GPIO_Port->IDR |= MUTE_Pin;
+
+  MuteButton muteButton;
+  LiveLed liveLed;
+  GraphicEqualizer graphicEqualiser;
+  VolumeControl volumeControl;
+  Audio audio(muteButton, liveLed, graphicEqualiser, volumeControl);
+
+  UsbCapture capture;
+
+  for (int8_t i = 0; i < 10; i++) {
+    graphicEqualiser.setBand(i, settings.bands[i]);
+  }
+
+  // Audio::setVolume takes the USB 1/256dB units
+
+  audio.setVolume(settings.volume * 128);
+
+  // the dither generator is seeded by the constructor so every run is the same
+
+  audio.getDither().setMode(settings.dither);
+  audio.setHighPass(settings.highPass);
+  audio.setNoiseGate(settings.gate);
+  audio.getGainRamp().setFadeTime(settings.fadeTime);
+
+  BufferSource source(input);
+  I2sDmaProducer producer(hi2s1, source);
+
+  // select the streaming format and rate as the class driver does when the host sets the
+  // alternate setting and the sampling frequency
+
+  capture.setSubframeSize(settings.bits / 8);
+
+  if (USBD_AUDIO_fops.Init(settings.sampleRate, settings.bits, MIC_NUM_CHANNELS) != USBD_OK
+      || USBD_AUDIO_fops.Record() != USBD_OK) {
+    return false;
+  }
+
+  // enough halves to cover the input, the last one is padded with silence
+
+  uint32_t samplesPerHalf = settings.sampleRate * MIC_MS_PER_PACKET / 1000 / 2;
+  uint32_t halves = (input.size() + samplesPerHalf - 1) / samplesPerHalf;
+
+  // mute toggles fall on packet boundaries so that the producer keeps its order of halves
+
+  uint32_t done = 0;
+  bool muted = false;
+
+  for (uint32_t ms : settings.muteTimes) {
+
+    uint32_t at = ms / MIC_MS_PER_PACKET * 2;
+
+    if (at > done && at < halves) {
+      producer.run(at - done, timer);
+      done = at;
+    }
+
+    muted = !muted;
+    USBD_AUDIO_fops.MuteCtl(muted);
+  }
+
+  producer.run(halves - done, timer);
+  USBD_AUDIO_fops.Stop();
+
+  output = capture.getSamples();
+  output.resize(input.size());
+
+  const VoiceActivityDetector &vad = audio.getVoiceActivityDetector();
+  voiceActivity = vad.getFrames() ? 100.0 * vad.getActiveFrames() / vad.getFrames() : 0;
+  return true;
+}
+
+/**
+ * The mute toggle times as a comma separated list of milliseconds
+ */
+
+static bool parseMuteTimes(const char *str, std::vector<uint32_t> &times) {
+
+  times.clear();
+
+  for (;;) {
+
+    char *end;
+    unsigned long value = strtoul(str, &end, 10);
+
+    if (end == str || (!times.empty() && value <= times.back())) {
+      return false;
+    }
+
+    times.push_back(value);
+    str = end;
+
+    if (*str == '\0') {
+      return true;
+    }
+
+    if (*str++ != ',') {
+      return false;
+    }
+  }
+}
+
+/**
+ * Compare the muted output with the unmuted reference. Through a linear ramp each sample can
+ * differ from the one before by no more than the reference does plus the change in gain times
+ * the signal, which is at most the peak over the fade length. Anything larger is a click. A
+ * few LSBs are allowed for the dither.
+ */
+
+static bool checkClicks(const std::vector<int32_t> &output, const std::vector<int32_t> &reference,
+    const PipelineSettings &settings) {
+
+  double peak = 0, excess = 0;
+
+  for (size_t i = 0; i < reference.size(); i++) {
+    peak = fmax(peak, fabs((double) reference[i]));
+  }
+
+  for (size_t i = 1; i < output.size(); i++) {
+
+    double step = fabs((double) output[i] - output[i - 1]);
+    double referenceStep = fabs((double) reference[i] - reference[i - 1]);
+
+    excess = fmax(excess, step - referenceStep);
+  }
+
+  // a ramp shorter than 1ms is heard as a click whatever the fade time is set to
+
+  uint32_t fadeSamples = (settings.fadeTime ? settings.fadeTime : 1) * settings.sampleRate / 1000;
+  double limit = 2 * peak / fadeSamples + 4.0 * (1 << (32 - settings.bits));
+  bool ok = excess <= limit;
+
+  printf("mute transitions: largest extra step %.1fdBFS, limit %.1fdBFS: %s\n", 20 * log10(excess / 2147483648.0 + 1e-12),
+      20 * log10(limit / 2147483648.0), ok ? "OK" : "CLICK");
+  return ok;
+}
+
+/**
+ * Parse a comma separated list of 10 band gains
+ */
+
+static bool parseBands(const char *str, int8_t *bands) {
+
+  for (int i = 0; i < 10; i++) {
+
+    char *end;
+    long value = strtol(str, &end, 10);
+
+    if (end == str || value < -12 || value > 12) {
+      return false;
+    }
+
+    bands[i] = value;
+    str = end;
+
+    if (i < 9) {
+      if (*str != ',') {
+        return false;
+      }
+      str++;
+    }
+  }
+
+  return *str == '\0';
+}
+
+/**
+ * Check or update every entry in a manifest. Each non-comment line is:
+ *   <input.wav> <volume> <b0,...,b9> <bits> <hash>
+ * Input paths are relative to the manifest.
+ */
+
+static int checkManifest(const char *manifestName, bool update) {
+
+  FILE *f = fopen(manifestName, "r");
+  if (!f) {
+    fprintf(stderr, "cannot open %s\n", manifestName);
+    return 1;
+  }
+
+  std::string dir(manifestName);
+  size_t slash = dir.rfind('/');
+  dir = slash == std::string::npos ? "" : dir.substr(0, slash + 1);
+
+  std::vector<std::string> lines;
+  char line[512];
+  int failures = 0;
+
+  while (fgets(line, sizeof(line), f)) {
+
+    char name[256], bandList[128], hashText[32];
+    int volume, bits;
+    PipelineSettings settings;
+
+    if (line[0] == '#' || sscanf(line, "%255s %d %127s %d %31s", name, &volume, bandList, &bits, hashText) < 4) {
+      lines.push_back(line);
+      continue;
+    }
+
+    if (!validBits(bits)) {
+      fprintf(stderr, "bad resolution: %d\n", bits);
+      fclose(f);
+      return 1;
+    }
+
+    settings.volume = volume;
+    settings.bits = bits;
+    settings.highPass = HighPassFilter(MIC_SAMPLE_FREQUENCY).getSettings();
+    settings.gate = NoiseGate(MIC_SAMPLE_FREQUENCY).getSettings();
+    settings.dither = Dither::TRIANGULAR;
+    settings.fadeTime = 5;
+
+    if (!parseBands(bandList, settings.bands)) {
+      fprintf(stderr, "bad band list: %s\n", bandList);
+      fclose(f);
+      return 1;
+    }
+
+    std::vector<int32_t> input;
+    std::vector<int32_t> output;
+    PacketTimer timer;
+    double voiceActivity;
+
+    if (!WavFile::read((dir + name).c_str(), input, settings.sampleRate)) {
+      fprintf(stderr, "cannot read %s\n", name);
+      fclose(f);
+      return 1;
+    }
+
+    if (!validSampleRate(settings.sampleRate)) {
+      settings.sampleRate = MIC_SAMPLE_FREQUENCY;
+    }
+
+    if (!runPipeline(input, settings, output, timer, voiceActivity)) {
+      fprintf(stderr, "failed to start the audio stream\n");
+      fclose(f);
+      return 1;
+    }
+
+    char actual[32];
+    snprintf(actual, sizeof(actual), "%016llx", (unsigned long long) hashSamples(output, bits));
+
+    bool match = strcmp(actual, hashText) == 0;
+
+    printf("%-8s %s volume %d eq %s bits %d voice %.1f%%\n", update ? "UPDATE" : match ? "OK" : "MISMATCH", name,
+        volume, bandList, bits, voiceActivity);
+    printf("         expected %s actual %s  ", hashText, actual);
+    timer.report(stdout, (MIC_MS_PER_PACKET / 2) * 1000.0);
+
+    if (!match && !update) {
+      failures++;
+    }
+
+    snprintf(line, sizeof(line), "%s %d %s %d %s\n", name, volume, bandList, bits, actual);
+    lines.push_back(line);
+  }
+
+  fclose(f);
+
+  if (update) {
+
+    if (!(f = fopen(manifestName, "w"))) {
+      fprintf(stderr, "cannot write %s\n", manifestName);
+      return 1;
+    }
+
+    for (const std::string &l : lines) {
+      fputs(l.c_str(), f);
+    }
+    fclose(f);
+  }
+
+  return failures ? 1 : 0;
+}
+
+static int usage() {
+  fprintf(stderr, "usage: wav-pipeline [--volume <n>] [--eq <b0,...,b9>] [--bits <n>] [--highpass <order,hz>] [--gate <t,r,a,h,r>] [--dither <mode>] [--fade <ms>] [--mute <ms,...>] [--timing <csv>] <in.wav> <out.wav>\n"
+      "       wav-pipeline --check <manifest> [--update]\n");
+  return 1;
+}
+
+int main(int argc, char *argv[]) {
+
+  PipelineSettings settings = { 0, { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 }, 16, MIC_SAMPLE_FREQUENCY,
+      HighPassFilter(MIC_SAMPLE_FREQUENCY).getSettings(), NoiseGate(MIC_SAMPLE_FREQUENCY).getSettings(), Dither::TRIANGULAR, 5 };
+  const char *timingName = nullptr;
+  const char *manifestName = nullptr;
+  bool update = false;
+  int i;
+
+  for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1] == '-'; i++) {
+
+    if (!strcmp(argv[i], "--update")) {
+      update = true;
+      continue;
+    }
+
+    if (i + 1 >= argc) {
+      return usage();
+    }
+
+    if (!strcmp(argv[i], "--volume")) {
+      settings.volume = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--eq")) {
+      if (!parseBands(argv[++i], settings.bands)) {
+        return usage();
+      }
+    } else if (!strcmp(argv[i], "--bits")) {
+      int bits = atoi(argv[++i]);
+      if (!validBits(bits)) {
+        return usage();
+      }
+      settings.bits = bits;
+    } else if (!strcmp(argv[i], "--highpass")) {
+      if (!parseHighPass(argv[++i], settings.highPass)) {
+        return usage();
+      }
+    } else if (!strcmp(argv[i], "--gate")) {
+      if (!parseGate(argv[++i], settings.gate)) {
+        return usage();
+      }
+    } else if (!strcmp(argv[i], "--dither")) {
+      if (!parseDither(argv[++i], settings.dither)) {
+        return usage();
+      }
+    } else if (!strcmp(argv[i], "--fade")) {
+      int fadeTime = atoi(argv[++i]);
+      if (fadeTime < 0 || fadeTime > 1000) {
+        return usage();
+      }
+      settings.fadeTime = fadeTime;
+    } else if (!strcmp(argv[i], "--mute")) {
+      if (!parseMuteTimes(argv[++i], settings.muteTimes)) {
+        return usage();
+      }
+    } else if (!strcmp(argv[i], "--timing")) {
+      timingName = argv[++i];
+    } else if (!strcmp(argv[i], "--check")) {
+      manifestName = argv[++i];
+    } else {
+      return usage();
+    }
+  }
+
+  if (manifestName) {
+    return checkManifest(manifestName, update);
+  }
+
+  if (argc - i != 2) {
+    return usage();
+  }
+
+  std::vector<int32_t> input;
+  std::vector<int32_t> output;
+  uint32_t sampleRate;
+  PacketTimer timer;
+  FILE *timing = nullptr;
+
+  if (!WavFile::read(argv[i], input, sampleRate)) {
+    fprintf(stderr, "cannot read %s (16 or 24 bit PCM WAV required)\n", argv[i]);
+    return 1;
+  }
+
+  if (validSampleRate(sampleRate)) {
+    settings.sampleRate = sampleRate;
+  } else {
+    fprintf(stderr, "note: %s is %uHz, the pipeline runs at %uHz\n", argv[i], sampleRate, MIC_SAMPLE_FREQUENCY);
+  }
+
+  if (timingName) {
+    if (!(timing = fopen(timingName, "w"))) {
+      fprintf(stderr, "cannot write %s\n", timingName);
+      return 1;
+    }
+    timer.setLog(timing);
+  }
+
+  double voiceActivity;
+  bool ok = runPipeline(input, settings, output, timer, voiceActivity);
+
+  if (timing) {
+    fclose(timing);
+  }
+
+  if (!ok) {
+    fprintf(stderr, "failed to start the audio stream\n");
+    return 1;
+  }
+
+  if (!WavFile::write(argv[i + 1], output, sampleRate, settings.bits)) {
+    fprintf(stderr, "cannot write %s\n", argv[i + 1]);
+    return 1;
+  }
+
+  printf("%u samples, hash %016llx, voice activity in %.1f%% of 10ms frames\n", (unsigned) output.size(),
+      (unsigned long long) hashSamples(output, settings.bits), voiceActivity);
+  timer.report(stdout, (MIC_MS_PER_PACKET / 2) * 1000.0);
+
+  if (!settings.muteTimes.empty()) {
+
+    PipelineSettings unmuted = settings;
+    std::vector<int32_t> reference;
+    PacketTimer referenceTimer;
+
+    unmuted.muteTimes.clear();
+
+    if (!runPipeline(input, unmuted, reference, referenceTimer, voiceActivity)) {
+      fprintf(stderr, "failed to start the audio stream\n");
+      return 1;
+    }
+
+    return checkClicks(output, reference, settings) ? 0 : 1;
+  }
+  return 0;
+}
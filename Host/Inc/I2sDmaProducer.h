@@ -0,0 +1,129 @@
+/*
+ * This file is part of the firmware for the Andy's Workshop USB Microphone.
+ * Copyright 2021 Andy Brown. See https://andybrown.me.uk for project details.
+ * This project is open source subject to the license published on https://andybrown.me.uk.
+ */
+
+#pragma once
+
+#include "SampleSource.h"
+#include "PacketTimer.h"
+
+extern "C" void PendSV_Handler();
+
+/**
+ * Synthetic replacement for the I2S DMA stream. It writes INMP441-style frames into the
+ * buffer registered with HAL_I2S_Receive_DMA and then calls the same HAL callbacks, in the
+ * same half/complete order, that the DMA2_Stream0 interrupt would call on the device. The
+ * PendSV handler runs straight after a callback that pends it, as it would on the device
+ * when no other interrupt is active.
+ *
+ * Each frame is 64 bits: a 32 bit left slot carrying the 24 bit sample left-justified,
+ * followed by an empty right slot. The DMA moves half-words, most significant first, so
+ * in memory the two halves of each 32-bit slot appear swapped.
+ */
+
+class I2sDmaProducer {
+
+  private:
+    I2S_HandleTypeDef &_hi2s;
+    SampleSource &_source;
+    bool _exhausted;
+
+  public:
+    I2sDmaProducer(I2S_HandleTypeDef &hi2s, SampleSource &source);
+
+    uint32_t run(uint32_t halves, PacketTimer &timer);
+    bool isExhausted() const;
+
+    static int32_t pack(int32_t sample);
+
+  private:
+    void fill(bool secondHalf);
+};
+
+inline I2sDmaProducer::I2sDmaProducer(I2S_HandleTypeDef &hi2s, SampleSource &source) :
+    _hi2s(hi2s), _source(source) {
+  _exhausted = false;
+}
+
+/**
+ * Convert a 24 bit sample into the 32 bit word that the DMA would deposit in memory
+ */
+
+inline int32_t I2sDmaProducer::pack(int32_t sample) {
+
+  uint32_t slot = ((uint32_t) sample) << 8;
+  return (int32_t) ((slot >> 16) | (slot << 16));
+}
+
+/**
+ * Fill one half of the DMA buffer from the sample source. The source running dry pads the
+ * rest of the buffer with silence.
+ */
+
+inline void I2sDmaProducer::fill(bool secondHalf) {
+
+  uint32_t words = _hi2s.RxXferSize / 2;
+  uint32_t framesPerHalf = words / 4;
+  int32_t *dest = reinterpret_cast<int32_t*>(_hi2s.pRxBuffPtr) + (secondHalf ? words / 2 : 0);
+
+  for (uint32_t i = 0; i < framesPerHalf; i++) {
+
+    int32_t sample = 0;
+
+    if (!_exhausted && !_source.next(sample)) {
+      _exhausted = true;
+      sample = 0;
+    }
+
+    *dest++ = pack(sample);    // left
+    *dest++ = 0;               // right is tri-stated by the INMP441
+  }
+}
+
+/**
+ * Run the DMA for a number of half-buffer periods, timing each callback
+ * @return The number of halves actually transferred
+ */
+
+inline uint32_t I2sDmaProducer::run(uint32_t halves, PacketTimer &timer) {
+
+  uint32_t i;
+
+  for (i = 0; i < halves && !_exhausted; i++) {
+
+    // the stream may have been stopped by the audio path
+
+    if (_hi2s.State != HAL_I2S_STATE_BUSY_RX) {
+      break;
+    }
+
+    bool secondHalf = (i & 1) != 0;
+
+    fill(secondHalf);
+    _hi2s.hdmarx->Instance->NDTR = secondHalf ? _hi2s.RxXferSize : _hi2s.RxXferSize / 2;
+    Host_AdvanceTick(MIC_MS_PER_PACKET / 2);
+
+    timer.begin();
+
+    if (secondHalf) {
+      HAL_I2S_RxCpltCallback(&_hi2s);
+    } else {
+      HAL_I2S_RxHalfCpltCallback(&_hi2s);
+    }
+
+    if (SCB->ICSR & SCB_ICSR_PENDSVSET_Msk) {
+      SCB->ICSR &= ~SCB_ICSR_PENDSVSET_Msk;
+      PendSV_Handler();
+    }
+
+    timer.end();
+  }
+
+  return i;
+}
+
+inline bool I2sDmaProducer::isExhausted() const {
+  return _exhausted;
+}
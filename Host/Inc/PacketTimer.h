@@ -0,0 +1,114 @@
+/*
+ * This file is part of the firmware for the Andy's Workshop USB Microphone.
+ * Copyright 2021 Andy Brown. See https://andybrown.me.uk for project details.
+ * This project is open source subject to the license published on https://andybrown.me.uk.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <stdio.h>
+
+/**
+ * Wall-clock statistics for the DMA callbacks. Each sample is the time taken by one
+ * half-buffer callback, i.e. one call to Audio::sendData.
+ */
+
+class PacketTimer {
+
+  private:
+    typedef std::chrono::steady_clock Clock;
+
+    Clock::time_point _start;
+    uint64_t _minNanos;
+    uint64_t _maxNanos;
+    uint64_t _totalNanos;
+    uint32_t _count;
+    FILE *_log;
+
+  public:
+    PacketTimer();
+
+    void setLog(FILE *log);
+
+    void begin();
+    void end();
+
+    uint32_t getCount() const;
+    double getMinMicros() const;
+    double getMaxMicros() const;
+    double getMeanMicros() const;
+
+    void report(FILE *stream, double budgetMicros) const;
+};
+
+inline PacketTimer::PacketTimer() {
+  _minNanos = UINT64_MAX;
+  _maxNanos = 0;
+  _totalNanos = 0;
+  _count = 0;
+  _log = nullptr;
+}
+
+/**
+ * Optionally write each packet's time to a CSV stream
+ */
+
+inline void PacketTimer::setLog(FILE *log) {
+  _log = log;
+
+  if (_log) {
+    fprintf(_log, "packet,micros\n");
+  }
+}
+
+inline void PacketTimer::begin() {
+  _start = Clock::now();
+}
+
+inline void PacketTimer::end() {
+
+  uint64_t nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - _start).count();
+
+  if (nanos < _minNanos) {
+    _minNanos = nanos;
+  }
+  if (nanos > _maxNanos) {
+    _maxNanos = nanos;
+  }
+
+  _totalNanos += nanos;
+
+  if (_log) {
+    fprintf(_log, "%u,%.3f\n", _count, nanos / 1000.0);
+  }
+
+  _count++;
+}
+
+inline uint32_t PacketTimer::getCount() const {
+  return _count;
+}
+
+inline double PacketTimer::getMinMicros() const {
+  return _count ? _minNanos / 1000.0 : 0;
+}
+
+inline double PacketTimer::getMaxMicros() const {
+  return _maxNanos / 1000.0;
+}
+
+inline double PacketTimer::getMeanMicros() const {
+  return _count ? (_totalNanos / 1000.0) / _count : 0;
+}
+
+/**
+ * Print a one-line summary. The budget is the real time available to each callback on the
+ * device, which gives a feel for how fast the host is compared to real time.
+ */
+
+inline void PacketTimer::report(FILE *stream, double budgetMicros) const {
+  fprintf(stream, "packets: %u  min: %.2fus  mean: %.2fus  max: %.2fus  budget: %.0fus  (%.0fx real time)\n",
+      _count, getMinMicros(), getMeanMicros(), getMaxMicros(), budgetMicros,
+      getMeanMicros() > 0 ? budgetMicros / getMeanMicros() : 0);
+}
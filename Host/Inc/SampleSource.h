@@ -0,0 +1,108 @@
+/*
+ * This file is part of the firmware for the Andy's Workshop USB Microphone.
+ * Copyright 2021 Andy Brown. See https://andybrown.me.uk for project details.
+ * This project is open source subject to the license published on https://andybrown.me.uk.
+ */
+
+#pragma once
+
+#include <math.h>
+#include <vector>
+
+/**
+ * A source of signed 24-bit microphone samples for the synthetic DMA producer
+ */
+
+class SampleSource {
+
+  public:
+    virtual ~SampleSource() {
+    }
+
+    /**
+     * Get the next sample
+     * @param sample The 24-bit sample, sign extended to 32 bits
+     * @return false if the source is exhausted
+     */
+
+    virtual bool next(int32_t &sample) = 0;
+};
+
+/**
+ * A sine wave with a small amount of noise riding on it, roughly what the INMP441 produces
+ * in a quiet room with someone talking near it. The noise generator is seeded so that every
+ * run produces the same stream.
+ */
+
+class SineSource: public SampleSource {
+
+  private:
+    double _phase;
+    double _increment;
+    double _amplitude;
+    double _noiseAmplitude;
+    uint32_t _noiseState;
+
+  public:
+    SineSource(double frequency, double sampleRate, double levelDbfs, double noiseDbfs);
+    bool next(int32_t &sample) override;
+};
+
+inline SineSource::SineSource(double frequency, double sampleRate, double levelDbfs, double noiseDbfs) {
+
+  _phase = 0;
+  _increment = 2 * M_PI * frequency / sampleRate;
+  _amplitude = 8388607.0 * pow(10.0, levelDbfs / 20.0);
+  _noiseAmplitude = 8388607.0 * pow(10.0, noiseDbfs / 20.0);
+  _noiseState = 0x12345678;
+}
+
+inline bool SineSource::next(int32_t &sample) {
+
+  // xorshift32 uniform noise in -1..1
+
+  _noiseState ^= _noiseState << 13;
+  _noiseState ^= _noiseState >> 17;
+  _noiseState ^= _noiseState << 5;
+
+  double noise = ((double) _noiseState / 2147483648.0) - 1.0;
+
+  sample = (int32_t) lrint(_amplitude * sin(_phase) + _noiseAmplitude * noise);
+  _phase += _increment;
+
+  if (_phase > 2 * M_PI) {
+    _phase -= 2 * M_PI;
+  }
+
+  return true;
+}
+
+/**
+ * Plays back a block of samples, e.g. the contents of a WAV file
+ */
+
+class BufferSource: public SampleSource {
+
+  private:
+    const std::vector<int32_t> &_samples;
+    size_t _position;
+
+  public:
+    BufferSource(const std::vector<int32_t> &samples);
+    bool next(int32_t &sample) override;
+};
+
+inline BufferSource::BufferSource(const std::vector<int32_t> &samples) :
+    _samples(samples) {
+  _position = 0;
+}
+
+inline bool BufferSource::next(int32_t &sample) {
+
+  if (_position >= _samples.size()) {
+    return false;
+  }
+
+  sample = _samples[_position++];
+  return true;
+}
@@ -0,0 +1,83 @@
+/*
+ * This file is part of the firmware for the Andy's Workshop USB Microphone.
+ * Copyright 2021 Andy Brown. See https://andybrown.me.uk for project details.
+ * This project is open source subject to the license published on https://andybrown.me.uk.
+ */
+
+#pragma once
+
+#include <vector>
+
+/**
+ * Collects everything that the audio path commits to the USB FIFO so that a host
+ * run can inspect or save exactly what the USB host would have received. The transfers are
+ * unpacked from the little-endian subframe format and kept left justified as Q31.
+ */
+
+class UsbCapture {
+
+  private:
+    std::vector<int32_t> _samples;
+    uint32_t _transfers;
+    uint8_t _subframeSize;
+
+  public:
+    static UsbCapture *_instance;
+
+  public:
+    UsbCapture();
+
+    void setSubframeSize(uint8_t subframeSize);
+    uint8_t getSubframeSize() const;
+
+    void append(const uint8_t *data, uint16_t count);
+    void clear();
+
+    const std::vector<int32_t>& getSamples() const;
+    uint32_t getTransfers() const;
+};
+
+inline UsbCapture::UsbCapture() {
+  _transfers = 0;
+  _subframeSize = 2;
+  UsbCapture::_instance = this;
+}
+
+/**
+ * Set the bytes per sample of the transfers, as selected by the USB alternate setting
+ */
+
+inline void UsbCapture::setSubframeSize(uint8_t subframeSize) {
+  _subframeSize = subframeSize;
+}
+
+inline uint8_t UsbCapture::getSubframeSize() const {
+  return _subframeSize;
+}
+
+inline void UsbCapture::append(const uint8_t *data, uint16_t count) {
+
+  for (uint16_t i = 0; i < count; i++) {
+
+    uint32_t sample = 0;
+
+    for (uint8_t j = 0; j < _subframeSize; j++) {
+      sample |= (uint32_t) *data++ << (32 - 8 * (_subframeSize - j));
+    }
+    _samples.push_back((int32_t) sample);
+  }
+  _transfers++;
+}
+
+inline void UsbCapture::clear() {
+  _samples.clear();
+  _transfers = 0;
+}
+
+inline const std::vector<int32_t>& UsbCapture::getSamples() const {
+  return _samples;
+}
+
+inline uint32_t UsbCapture::getTransfers() const {
+  return _transfers;
+}
@@ -0,0 +1,162 @@
+/*
+ * This file is part of the firmware for the Andy's Workshop USB Microphone.
+ * Copyright 2021 Andy Brown. See https://andybrown.me.uk for project details.
+ * This project is open source subject to the license published on https://andybrown.me.uk.
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+/**
+ * Minimal RIFF/WAVE PCM reader and writer. Input files may be 16 or 24 bit with any number
+ * of channels; only the first channel is used. Output files are mono in any of the 16, 24
+ * and 32 bit formats that the microphone can stream to the host.
+ */
+
+class WavFile {
+
+  public:
+    static bool read(const char *filename, std::vector<int32_t> &samples, uint32_t &sampleRate);
+    static bool write(const char *filename, const std::vector<int32_t> &samples, uint32_t sampleRate, uint8_t bits);
+
+  private:
+    static uint32_t get32(const uint8_t *p);
+    static uint16_t get16(const uint8_t *p);
+    static void put32(FILE *f, uint32_t value);
+    static void put16(FILE *f, uint16_t value);
+};
+
+inline uint32_t WavFile::get32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+inline uint16_t WavFile::get16(const uint8_t *p) {
+  return p[0] | (p[1] << 8);
+}
+
+inline void WavFile::put32(FILE *f, uint32_t value) {
+  uint8_t b[4] = { (uint8_t) value, (uint8_t) (value >> 8), (uint8_t) (value >> 16), (uint8_t) (value >> 24) };
+  fwrite(b, 1, sizeof(b), f);
+}
+
+inline void WavFile::put16(FILE *f, uint16_t value) {
+  uint8_t b[2] = { (uint8_t) value, (uint8_t) (value >> 8) };
+  fwrite(b, 1, sizeof(b), f);
+}
+
+/**
+ * Read the first channel of a PCM WAV file
+ * @param samples Receives the samples scaled to signed 24 bit
+ */
+
+inline bool WavFile::read(const char *filename, std::vector<int32_t> &samples, uint32_t &sampleRate) {
+
+  FILE *f = fopen(filename, "rb");
+  if (!f) {
+    return false;
+  }
+
+  std::vector<uint8_t> file;
+  uint8_t chunk[65536];
+  size_t n;
+
+  while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+    file.insert(file.end(), chunk, chunk + n);
+  }
+  fclose(f);
+
+  if (file.size() < 12 || memcmp(&file[0], "RIFF", 4) != 0 || memcmp(&file[8], "WAVE", 4) != 0) {
+    return false;
+  }
+
+  uint16_t channels = 0, bitsPerSample = 0, format = 0;
+  size_t pos = 12;
+
+  while (pos + 8 <= file.size()) {
+
+    const uint8_t *header = &file[pos];
+    uint32_t size = get32(header + 4);
+    const uint8_t *body = header + 8;
+
+    if (pos + 8 + size > file.size()) {
+      size = file.size() - pos - 8;
+    }
+
+    if (memcmp(header, "fmt ", 4) == 0 && size >= 16) {
+      format = get16(body);
+      channels = get16(body + 2);
+      sampleRate = get32(body + 4);
+      bitsPerSample = get16(body + 14);
+    }
+    else if (memcmp(header, "data", 4) == 0) {
+
+      if (format != 1 || channels == 0 || (bitsPerSample != 16 && bitsPerSample != 24)) {
+        return false;
+      }
+
+      uint32_t frameBytes = channels * (bitsPerSample / 8);
+      uint32_t frames = size / frameBytes;
+
+      samples.resize(frames);
+
+      for (uint32_t i = 0; i < frames; i++) {
+
+        const uint8_t *p = body + i * frameBytes;
+
+        if (bitsPerSample == 16) {
+          samples[i] = ((int32_t) (int16_t) get16(p)) << 8;
+        } else {
+          samples[i] = ((int32_t) ((p[0] << 8) | (p[1] << 16) | ((uint32_t) p[2] << 24))) >> 8;
+        }
+      }
+      return true;
+    }
+
+    pos += 8 + size + (size & 1);
+  }
+
+  return false;
+}
+
+/**
+ * Write mono PCM
+ * @param samples Left justified Q31 samples. Only the top 'bits' bits of each are written.
+ * @param bits 16, 24 or 32
+ */
+
+inline bool WavFile::write(const char *filename, const std::vector<int32_t> &samples, uint32_t sampleRate,
+    uint8_t bits) {
+
+  FILE *f = fopen(filename, "wb");
+  if (!f) {
+    return false;
+  }
+
+  uint8_t bytes = bits / 8;
+  uint32_t dataBytes = samples.size() * bytes;
+
+  fwrite("RIFF", 1, 4, f);
+  put32(f, 36 + dataBytes);
+  fwrite("WAVEfmt ", 1, 8, f);
+  put32(f, 16);
+  put16(f, 1);                    // PCM
+  put16(f, 1);                    // mono
+  put32(f, sampleRate);
+  put32(f, sampleRate * bytes);   // byte rate
+  put16(f, bytes);                // block align
+  put16(f, bits);                 // bits per sample
+  fwrite("data", 1, 4, f);
+  put32(f, dataBytes);
+
+  for (int32_t sample : samples) {
+    for (uint8_t i = 0; i < bytes; i++) {
+      fputc((uint8_t) ((uint32_t) sample >> (32 - 8 * (bytes - i))), f);
+    }
+  }
+
+  bool ok = ferror(f) == 0;
+  return fclose(f) == 0 && ok;
+}
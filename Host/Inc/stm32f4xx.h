@@ -0,0 +1,149 @@
+/*
+ * This file is part of the firmware for the Andy's Workshop USB Microphone.
+ * Copyright 2021 Andy Brown. See https://andybrown.me.uk for project details.
+ * This project is open source subject to the license published on https://andybrown.me.uk.
+ */
+
+#pragma once
+
+/**
+ * Host build stand-in for the CMSIS device header. Only the handful of definitions that
+ * the audio path and the USB class headers actually touch are provided here.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef __IO
+#define __IO volatile
+#endif
+
+#ifndef __STATIC_INLINE
+#define __STATIC_INLINE static inline
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The DWT cycle counter. On the host it counts nanoseconds and SystemCoreClock is set to
+ * 1GHz so that cycle counts convert to real time in the same way as on the device.
+ */
+
+typedef struct {
+  __IO uint32_t CTRL;
+  __IO uint32_t CYCCNT;
+} DWT_Type;
+
+typedef struct {
+  __IO uint32_t DEMCR;
+} CoreDebug_Type;
+
+#define DWT_CTRL_CYCCNTENA_Msk (1UL)
+#define CoreDebug_DEMCR_TRCENA_Msk (1UL << 24)
+
+DWT_Type *Host_ReadDwt(void);
+extern CoreDebug_Type HostCoreDebug;
+
+#define DWT (Host_ReadDwt())
+#define CoreDebug (&HostCoreDebug)
+
+extern uint32_t SystemCoreClock;
+
+/*
+ * The system control block, for pending PendSV. The host build's I2S DMA producer runs the
+ * handler when it sees the bit set.
+ */
+
+typedef struct {
+  __IO uint32_t ICSR;
+} SCB_Type;
+
+#define SCB_ICSR_PENDSVSET_Msk (1UL << 28)
+
+extern SCB_Type HostScb;
+
+#define SCB (&HostScb)
+
+/*
+ * SysTick, for the main loop's idle time. Nothing drives it on the host.
+ */
+
+typedef struct {
+  __IO uint32_t CTRL;
+  __IO uint32_t LOAD;
+  __IO uint32_t VAL;
+} SysTick_Type;
+
+#define SysTick_CTRL_COUNTFLAG_Msk (1U << 16)
+
+extern SysTick_Type HostSysTick;
+
+#define SysTick (&HostSysTick)
+
+/*
+ * The EXTI controller and a basic timer, for the mute button's edge interrupt and debounce
+ * timer. Nothing drives them on the host.
+ */
+
+typedef struct {
+  __IO uint32_t IMR;
+  __IO uint32_t PR;
+} EXTI_TypeDef;
+
+typedef struct {
+  __IO uint32_t CR1;
+  __IO uint32_t DIER;
+  __IO uint32_t SR;
+  __IO uint32_t EGR;
+  __IO uint32_t CNT;
+  __IO uint32_t PSC;
+  __IO uint32_t ARR;
+} TIM_TypeDef;
+
+#define TIM_CR1_CEN (1U)
+#define TIM_SR_UIF (1U)
+
+extern EXTI_TypeDef HostExti;
+extern TIM_TypeDef HostTim7;
+
+#define EXTI (&HostExti)
+#define TIM7 (&HostTim7)
+
+/*
+ * Portable equivalents of the CMSIS core intrinsics used by the DSP code and the main loop
+ */
+
+__STATIC_INLINE int32_t __SSAT(int32_t val, uint32_t sat) {
+  const int32_t max = (int32_t) ((1U << (sat - 1U)) - 1U);
+  const int32_t min = -1 - max;
+  return val > max ? max : val < min ? min : val;
+}
+
+__STATIC_INLINE uint32_t __ROR(uint32_t op1, uint32_t op2) {
+  op2 %= 32U;
+  return op2 == 0U ? op1 : (op1 >> op2) | (op1 << (32U - op2));
+}
+
+__STATIC_INLINE int32_t __QADD(int32_t op1, int32_t op2) {
+  const int64_t sum = (int64_t) op1 + op2;
+  return sum > INT32_MAX ? INT32_MAX : sum < INT32_MIN ? INT32_MIN : (int32_t) sum;
+}
+
+__STATIC_INLINE void __DMB(void) {
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+__STATIC_INLINE void __disable_irq(void) {
+}
+
+__STATIC_INLINE void __enable_irq(void) {
+}
+
+__STATIC_INLINE void __WFI(void) {
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,132 @@
+/*
+ * This file is part of the firmware for the Andy's Workshop USB Microphone.
+ * Copyright 2021 Andy Brown. See https://andybrown.me.uk for project details.
+ * This project is open source subject to the license published on https://andybrown.me.uk.
+ */
+
+#pragma once
+
+/**
+ * Host build stand-in for the STM32 HAL. The types mirror the field names of the real HAL
+ * structures that the firmware uses so that the application headers compile unchanged. The
+ * implementations are in Host/Src/HalStubs.cpp.
+ */
+
+#include "stm32f4xx.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+  HAL_OK = 0x00U,
+  HAL_ERROR = 0x01U,
+  HAL_BUSY = 0x02U,
+  HAL_TIMEOUT = 0x03U
+} HAL_StatusTypeDef;
+
+/*
+ * GPIO
+ */
+
+typedef enum {
+  GPIO_PIN_RESET = 0,
+  GPIO_PIN_SET
+} GPIO_PinState;
+
+typedef struct {
+  __IO uint32_t IDR;
+  __IO uint32_t ODR;
+} GPIO_TypeDef;
+
+extern GPIO_TypeDef HostGPIOA;
+extern GPIO_TypeDef HostGPIOB;
+extern GPIO_TypeDef HostGPIOC;
+
+#define GPIOA (&HostGPIOA)
+#define GPIOB (&HostGPIOB)
+#define GPIOC (&HostGPIOC)
+
+#define GPIO_PIN_0  ((uint16_t)0x0001)
+#define GPIO_PIN_1  ((uint16_t)0x0002)
+#define GPIO_PIN_2  ((uint16_t)0x0004)
+#define GPIO_PIN_3  ((uint16_t)0x0008)
+#define GPIO_PIN_4  ((uint16_t)0x0010)
+#define GPIO_PIN_5  ((uint16_t)0x0020)
+#define GPIO_PIN_6  ((uint16_t)0x0040)
+#define GPIO_PIN_7  ((uint16_t)0x0080)
+#define GPIO_PIN_8  ((uint16_t)0x0100)
+#define GPIO_PIN_9  ((uint16_t)0x0200)
+#define GPIO_PIN_10 ((uint16_t)0x0400)
+#define GPIO_PIN_11 ((uint16_t)0x0800)
+#define GPIO_PIN_12 ((uint16_t)0x1000)
+#define GPIO_PIN_13 ((uint16_t)0x2000)
+#define GPIO_PIN_14 ((uint16_t)0x4000)
+#define GPIO_PIN_15 ((uint16_t)0x8000)
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState);
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin);
+
+/*
+ * DMA. Only the stream's count of remaining items is modelled, which the producer updates
+ * as it fills each half of the buffer.
+ */
+
+typedef struct {
+  __IO uint32_t NDTR;
+} DMA_Stream_TypeDef;
+
+typedef struct {
+  DMA_Stream_TypeDef *Instance;
+} DMA_HandleTypeDef;
+
+#define __HAL_DMA_GET_COUNTER(__HANDLE__) ((__HANDLE__)->Instance->NDTR)
+
+/*
+ * I2S. The DMA target and size are recorded in the handle exactly where the real HAL
+ * keeps them so that the synthetic DMA producer can find the buffer.
+ */
+
+typedef struct {
+  uint32_t Mode;
+  uint32_t Standard;
+  uint32_t DataFormat;
+  uint32_t AudioFreq;
+} I2S_InitTypeDef;
+
+typedef enum {
+  HAL_I2S_STATE_RESET = 0x00U,
+  HAL_I2S_STATE_READY = 0x01U,
+  HAL_I2S_STATE_BUSY_RX = 0x04U,
+  HAL_I2S_STATE_PAUSE = 0x06U
+} HAL_I2S_StateTypeDef;
+
+typedef struct {
+  void *Instance;
+  I2S_InitTypeDef Init;
+  uint16_t *pRxBuffPtr;
+  __IO uint16_t RxXferSize;
+  DMA_HandleTypeDef *hdmarx;
+  __IO HAL_I2S_StateTypeDef State;
+} I2S_HandleTypeDef;
+
+HAL_StatusTypeDef HAL_I2S_Receive_DMA(I2S_HandleTypeDef *hi2s, uint16_t *pData, uint16_t Size);
+HAL_StatusTypeDef HAL_I2S_DMAStop(I2S_HandleTypeDef *hi2s);
+HAL_StatusTypeDef HAL_I2S_DMAPause(I2S_HandleTypeDef *hi2s);
+HAL_StatusTypeDef HAL_I2S_DMAResume(I2S_HandleTypeDef *hi2s);
+
+void HAL_I2S_RxHalfCpltCallback(I2S_HandleTypeDef *hi2s);
+void HAL_I2S_RxCpltCallback(I2S_HandleTypeDef *hi2s);
+
+/*
+ * Time base. The host tick only advances when the DMA producer says so, which keeps every
+ * run deterministic.
+ */
+
+uint32_t HAL_GetTick(void);
+void HAL_Delay(uint32_t Delay);
+void Host_AdvanceTick(uint32_t ms);
+
+#ifdef __cplusplus
+}
+#endif
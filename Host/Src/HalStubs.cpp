@@ -0,0 +1,146 @@
+/*
+ * This file is part of the firmware for the Andy's Workshop USB Microphone.
+ * Copyright 2021 Andy Brown. See https://andybrown.me.uk for project details.
+ * This project is open source subject to the license published on https://andybrown.me.uk.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+extern "C" {
+#include "main.h"
+#include "usb_device.h"
+}
+
+/*
+ * Peripheral handles that main.c and usb_device.c would normally own
+ */
+
+I2S_HandleTypeDef hi2s1;
+USBD_HandleTypeDef hUsbDeviceFS;
+
+GPIO_TypeDef HostGPIOA;
+GPIO_TypeDef HostGPIOB;
+GPIO_TypeDef HostGPIOC;
+
+CoreDebug_Type HostCoreDebug;
+SCB_Type HostScb;
+SysTick_Type HostSysTick;
+EXTI_TypeDef HostExti;
+TIM_TypeDef HostTim7;
+uint32_t SystemCoreClock = 1000000000;
+
+static DWT_Type hostDwt;
+static uint32_t hostTick;
+
+extern "C" {
+
+/**
+ * Fatal errors abort the host run with a non-zero exit code
+ */
+
+void Error_Handler() {
+  fprintf(stderr, "Error_Handler() called\n");
+  exit(1);
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState) {
+  if (PinState == GPIO_PIN_SET) {
+    GPIOx->ODR |= GPIO_Pin;
+  } else {
+    GPIOx->ODR &= ~(uint32_t) GPIO_Pin;
+  }
+}
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin) {
+  return (GPIOx->IDR & GPIO_Pin) ? GPIO_PIN_SET : GPIO_PIN_RESET;
+}
+
+/**
+ * The real HAL doubles the size for the 24/32-bit data formats because the DMA moves
+ * half-words. We keep the same convention so the producer can recover the buffer length.
+ */
+
+HAL_StatusTypeDef HAL_I2S_Receive_DMA(I2S_HandleTypeDef *hi2s, uint16_t *pData, uint16_t Size) {
+
+  if (hi2s->State != HAL_I2S_STATE_READY && hi2s->State != HAL_I2S_STATE_RESET) {
+    return HAL_BUSY;
+  }
+
+  static DMA_Stream_TypeDef stream;
+  static DMA_HandleTypeDef hdma = { &stream };
+
+  hi2s->pRxBuffPtr = pData;
+  hi2s->RxXferSize = Size * 2;
+  hi2s->hdmarx = &hdma;
+  stream.NDTR = hi2s->RxXferSize;
+  hi2s->State = HAL_I2S_STATE_BUSY_RX;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2S_DMAStop(I2S_HandleTypeDef *hi2s) {
+  hi2s->State = HAL_I2S_STATE_READY;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2S_DMAPause(I2S_HandleTypeDef *hi2s) {
+  if (hi2s->State == HAL_I2S_STATE_BUSY_RX) {
+    hi2s->State = HAL_I2S_STATE_PAUSE;
+  }
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2S_DMAResume(I2S_HandleTypeDef *hi2s) {
+  if (hi2s->State == HAL_I2S_STATE_PAUSE) {
+    hi2s->State = HAL_I2S_STATE_BUSY_RX;
+  }
+  return HAL_OK;
+}
+
+/**
+ * Reclocking only records the new rate. The same rates as main.c are accepted and, like the
+ * real I2S, the stream has to be stopped first.
+ */
+
+HAL_StatusTypeDef MX_I2S1_SetSampleRate(uint32_t sampleRate) {
+
+  if (hi2s1.State == HAL_I2S_STATE_BUSY_RX || hi2s1.State == HAL_I2S_STATE_PAUSE) {
+    return HAL_BUSY;
+  }
+
+  if (sampleRate != 16000 && sampleRate != 32000 && sampleRate != 44100 && sampleRate != 48000
+      && sampleRate != 96000) {
+    return HAL_ERROR;
+  }
+
+  hi2s1.Init.AudioFreq = sampleRate;
+  return HAL_OK;
+}
+
+uint32_t HAL_GetTick(void) {
+  return hostTick;
+}
+
+void HAL_Delay(uint32_t Delay) {
+  hostTick += Delay;
+}
+
+void Host_AdvanceTick(uint32_t ms) {
+  hostTick += ms;
+}
+
+/**
+ * Every access to DWT refreshes the cycle counter from the monotonic clock
+ */
+
+DWT_Type *Host_ReadDwt(void) {
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  hostDwt.CYCCNT = (uint32_t) ((uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+  return &hostDwt;
+}
+
+}
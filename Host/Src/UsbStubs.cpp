@@ -0,0 +1,47 @@
+/*
+ * This file is part of the firmware for the Andy's Workshop USB Microphone.
+ * Copyright 2021 Andy Brown. See https://andybrown.me.uk for project details.
+ * This project is open source subject to the license published on https://andybrown.me.uk.
+ */
+
+#include "Application.h"
+#include "UsbCapture.h"
+
+UsbCapture *UsbCapture::_instance = nullptr;
+
+extern "C" {
+
+/*
+ * The equalizer parameters are normally owned by usbd_audio_in.c
+ */
+
+greq_dynamic_param_t *pEqualizerParams;
+
+/**
+ * Stand-ins for the class driver's transfer functions. The audio path writes into a
+ * scratch block instead of the isochronous FIFO and the data goes into the capture object.
+ */
+
+static uint8_t transferBlock[AUDIO_IN_MAX_TRANSFER_SIZE];
+
+uint8_t* USBD_AUDIO_Reserve_Transfer(USBD_HandleTypeDef *pdev, uint16_t PCMSamples) {
+  return PCMSamples * 4 <= AUDIO_IN_MAX_TRANSFER_SIZE ? transferBlock : nullptr;
+}
+
+uint8_t USBD_AUDIO_Commit_Transfer(USBD_HandleTypeDef *pdev, uint16_t PCMSamples) {
+
+  if (UsbCapture::_instance) {
+    UsbCapture::_instance->append(transferBlock, PCMSamples);
+  }
+  return USBD_OK;
+}
+
+/**
+ * The host tools don't suspend the bus
+ */
+
+uint8_t USBD_AUDIO_Suspend(USBD_HandleTypeDef *pdev) {
+  return USBD_OK;
+}
+
+}
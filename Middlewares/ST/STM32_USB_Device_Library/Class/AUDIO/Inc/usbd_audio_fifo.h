@@ -0,0 +1,124 @@
+/**
+ ******************************************************************************
+ * @file    usbd_audio_fifo.h
+ * @brief   Lock-free single-producer/single-consumer byte FIFO that carries the
+ *          audio stream from the I2S DMA interrupt to the USB interrupt.
+ ******************************************************************************
+ * @attention
+ *
+ * The producer owns the head index and the consumer owns the tail index. Both
+ * run freely and wrap at 2^32, so the fill level is always head - tail and a
+ * full FIFO can be told apart from an empty one without a spare slot. Each side
+ * publishes its index only after a memory barrier so the other side never sees
+ * an index move before the data it covers.
+ *
+ * The storage is the power-of-two capacity followed by a mirror of its first
+ * bytes. Any write or read of up to 'mirror' bytes is contiguous in memory,
+ * so the producer can reserve a block and fill it in place and the consumer
+ * can hand a packet straight to the USB core without copying it first.
+ *
+ ******************************************************************************
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include "stm32f4xx.h"
+
+typedef struct {
+    uint8_t *buffer;          /* capacity + mirror bytes */
+    uint32_t capacity;        /* a power of two */
+    uint32_t mirror;          /* largest contiguous reserve or peek */
+    __IO uint32_t head;       /* bytes ever committed, written by the producer */
+    __IO uint32_t tail;       /* bytes ever released, written by the consumer */
+} AUDIO_FifoTypeDef;
+
+/**
+ * @brief  Attach the FIFO to its storage and empty it
+ * @param  fifo: the FIFO
+ * @param  buffer: capacity + mirror bytes of storage
+ * @param  capacity: FIFO size in bytes, a power of two
+ * @param  mirror: largest block that will be reserved or peeked, at most capacity / 2
+ */
+__STATIC_INLINE void AUDIO_FIFO_Init(AUDIO_FifoTypeDef *fifo, uint8_t *buffer, uint32_t capacity, uint32_t mirror) {
+  fifo->buffer = buffer;
+  fifo->capacity = capacity;
+  fifo->mirror = mirror;
+  fifo->head = 0;
+  fifo->tail = 0;
+}
+
+/**
+ * @brief  Empty the FIFO. Both indices are written so this may only be called
+ *         while the consumer is known not to be reading.
+ */
+__STATIC_INLINE void AUDIO_FIFO_Reset(AUDIO_FifoTypeDef *fifo) {
+  fifo->tail = fifo->head;
+}
+
+/**
+ * @brief  Bytes committed but not yet released (consumer side, acquire)
+ */
+__STATIC_INLINE uint32_t AUDIO_FIFO_Count(AUDIO_FifoTypeDef *fifo) {
+  uint32_t count = fifo->head - fifo->tail;
+  __DMB();
+  return count;
+}
+
+/**
+ * @brief  Reserve a contiguous block at the head for the producer to fill in place
+ * @param  fifo: the FIFO
+ * @param  length: block size, at most fifo->mirror
+ * @retval the block, or NULL if the consumer has not yet released enough space
+ */
+__STATIC_INLINE uint8_t* AUDIO_FIFO_Reserve(AUDIO_FifoTypeDef *fifo, uint32_t length) {
+
+  uint32_t head = fifo->head;
+
+  if (length > fifo->mirror || fifo->capacity - (head - fifo->tail) < length) {
+    return NULL;
+  }
+
+  /* the space must be seen as free before it is overwritten */
+  __DMB();
+  return fifo->buffer + (head & (fifo->capacity - 1));
+}
+
+/**
+ * @brief  Publish a block previously filled through AUDIO_FIFO_Reserve (producer
+ *         side, release). The part of the block that lies in the mirror is copied
+ *         to the start of the FIFO and the part that lies at the start is copied
+ *         into the mirror, keeping the two identical.
+ */
+__STATIC_INLINE void AUDIO_FIFO_Commit(AUDIO_FifoTypeDef *fifo, uint32_t length) {
+
+  uint32_t offset = fifo->head & (fifo->capacity - 1);
+
+  if (offset + length > fifo->capacity) {
+    memcpy(fifo->buffer, fifo->buffer + fifo->capacity, offset + length - fifo->capacity);
+  } else if (offset < fifo->mirror) {
+    uint32_t end = offset + length < fifo->mirror ? offset + length : fifo->mirror;
+    memcpy(fifo->buffer + fifo->capacity + offset, fifo->buffer + offset, end - offset);
+  }
+
+  __DMB();
+  fifo->head += length;
+}
+
+/**
+ * @brief  The oldest committed data, contiguous for up to fifo->mirror bytes.
+ *         Call AUDIO_FIFO_Count first to find out how much of it is valid.
+ */
+__STATIC_INLINE uint8_t* AUDIO_FIFO_Peek(AUDIO_FifoTypeDef *fifo) {
+  return fifo->buffer + (fifo->tail & (fifo->capacity - 1));
+}
+
+/**
+ * @brief  Hand bytes that the consumer has finished with back to the producer
+ *         (consumer side, release)
+ */
+__STATIC_INLINE void AUDIO_FIFO_Release(AUDIO_FifoTypeDef *fifo, uint32_t length) {
+  __DMB();
+  fifo->tail += length;
+}
@@ -44,9 +44,10 @@
 #pragma once
 
 #include "usbd_ioreq.h"
+#include "usbd_audio_fifo.h"
 
 #define AUDIO_OUT_EP                                  0x01
-#define USB_AUDIO_CONFIG_DESC_SIZ                     109
+#define USB_AUDIO_CONFIG_DESC_SIZ                     (66 + AUDIO_ALT_SETTING_COUNT * AUDIO_ALT_SETTING_DESC_SIZE)
 #define AUDIO_INTERFACE_DESC_SIZE                     9
 #define USB_AUDIO_DESC_SIZ                            0x09
 #define AUDIO_STANDARD_ENDPOINT_DESC_SIZE             0x09
@@ -82,6 +83,21 @@
 
 #define AUDIO_CTRL_REQ_SET_CUR_VOLUME    0x01
 #define AUDIO_CTRL_REQ_SET_CUR_EQUALIZER 0x02
+#define AUDIO_CTRL_REQ_SET_CUR_FREQUENCY 0x03
+#define AUDIO_CTRL_REQ_VENDOR_SET        0x04
+#define AUDIO_CTRL_REQ_SET_CUR_MUTE      0x05
+
+/* Streaming alternate settings of interface 1: 16, 24 and 32 bit subframes */
+#define AUDIO_ALT_SETTING_COUNT                       3
+#define AUDIO_ALT_SETTING_DESC_SIZE                   (40 + AUDIO_SAMPLING_FREQUENCY_COUNT * 3)    /* AS interface, AS general, format, endpoint, AS endpoint */
+
+/* Discrete sampling frequencies listed in each format descriptor */
+#define AUDIO_SAMPLING_FREQUENCY_COUNT                5
+#define AUDIO_MAX_SAMPLING_FREQUENCY                  96000
+#define AUDIO_SAMPLING_FREQ_CONTROL                   0x01
+
+/* Largest vendor-specific transfer in either direction */
+#define AUDIO_VENDOR_BUFFER_SIZE                      128
 
 #define VOL_MIN                                       0xb000    // -80dB (1 == 1/256dB)
 #define VOL_RES                                       128       // 0.5dB (1 == 1/256dB)
@@ -104,13 +120,47 @@
 #define FEATURE_AUTO_GAIN  0x40
 #define FEATURE_DELAY      0x80
 
+/* Feature unit control selectors, the high byte of wValue. Mute and volume have the same
+   values as their bits in bmaControls above but the graphic equalizer doesn't. */
+#define AUDIO_MUTE_CONTROL                            0x01
+#define AUDIO_VOLUME_CONTROL                          0x02
+#define AUDIO_GRAPHIC_EQUALIZER_CONTROL               0x06
+
+/* The graphic equalizer supports the first 10 bands of bmBandsPresent. Its parameter block is
+   the 4 byte bmBandsPresent followed by a signed gain in 0.25dB units for each band present. */
+#define AUDIO_GRAPHIC_EQ_BANDS                        10
+#define AUDIO_GRAPHIC_EQ_PARAM_SIZE                   (4 + AUDIO_GRAPHIC_EQ_BANDS)
+
 /* Buffering state definitions */
 typedef enum {
   STATE_USB_WAITING_FOR_INIT = 0, STATE_USB_IDLE = 1, STATE_USB_REQUESTS_STARTED = 2, STATE_USB_BUFFER_WRITE_STARTED = 3,
 } AUDIO_StatesTypeDef;
 
-/* Number of sub-packets in the audio transfer buffer.*/
-#define AUDIO_IN_PACKET_NUM                            6
+/* Silence queued ahead of the first transfer of a stream. The FIFO level is held at this
+   plus half a transfer, so it's the margin against the interface's transfers arriving late. */
+#ifndef AUDIO_IN_LEAD_MS
+#define AUDIO_IN_LEAD_MS                               3
+#endif
+
+/* Asynchronous rate matching. The interface's sample rate is measured against the host's
+   1ms frames over 2^AUDIO_RATE_WINDOW_SHIFT frames and any difference between the FIFO level
+   and its target adds AUDIO_LEVEL_GAIN/65536 samples per frame per sample of error. */
+#define AUDIO_RATE_WINDOW_SHIFT                        10
+#define AUDIO_LEVEL_GAIN                               8
+
+/* Largest amount of data passed to USBD_AUDIO_Data_Transfer: 10ms of mono 32 bit samples at the
+   highest sampling frequency. The FIFO between the interface and the endpoint is a power of two
+   that holds two of these, followed by a mirror of its first transfer so that every transfer
+   and every packet is contiguous in memory. */
+#ifndef AUDIO_IN_MAX_TRANSFER_SIZE
+#define AUDIO_IN_MAX_TRANSFER_SIZE                     ((AUDIO_MAX_SAMPLING_FREQUENCY / 1000) * 10 * 4)
+#endif
+#define AUDIO_IN_FIFO_SIZE                             8192
+#define AUDIO_IN_BUFFER_SIZE                           (AUDIO_IN_FIFO_SIZE + AUDIO_IN_MAX_TRANSFER_SIZE)
+
+#if (AUDIO_IN_FIFO_SIZE & (AUDIO_IN_FIFO_SIZE - 1)) != 0 || AUDIO_IN_FIFO_SIZE < AUDIO_IN_MAX_TRANSFER_SIZE * 2
+#error "AUDIO_IN_FIFO_SIZE must be a power of two that holds two transfers"
+#endif
 
 #define TIMEOUT_VALUE                                   200
 
@@ -128,23 +178,27 @@ typedef struct {
     uint8_t data[USB_MAX_EP0_SIZE];
     uint8_t len;
     uint8_t unit;
+    uint16_t value;             /* wValue of a vendor request */
 } USBD_AUDIO_ControlTypeDef;
 
 typedef struct {
     __IO uint32_t alt_setting;
     uint8_t channels;
     uint32_t frequency;
+    uint8_t subframe_size;
     __IO int16_t timeout;
-    uint16_t buffer_length;
     uint16_t dataAmount;
     uint16_t paketDimension;
-    uint8_t state;
-    uint16_t rd_ptr;
-    uint16_t wr_ptr;
-    uint8_t upper_treshold;
-    uint8_t lower_treshold;
+    __IO uint8_t state;         /* changed by the USB interrupt and by the interface */
+    uint16_t in_flight;         /* bytes of the packet being sent, released at its DataIn */
+    uint16_t reserved;          /* bytes of the transfer reserved by the interface */
+    uint32_t feedback;          /* measured samples per USB frame, Q16.16 */
+    uint32_t accumulator;       /* fraction of a sample carried into the next packet, Q16.16 */
+    uint32_t target;            /* FIFO level that the packet sizes steer towards, in samples */
+    uint32_t window_start;      /* interface sample count at the start of the rate window */
+    uint16_t sof_count;         /* frames into the rate window */
     USBD_AUDIO_ControlTypeDef control;
-    uint8_t *buffer;
+    AUDIO_FifoTypeDef fifo;     /* written by USBD_AUDIO_Data_Transfer, read by DataIn */
 } USBD_AUDIO_HandleTypeDef;
 
 typedef struct {
@@ -153,14 +207,21 @@ typedef struct {
     int8_t (*Record)(void);
     int8_t (*VolumeCtl)(int16_t Volume);
     int8_t (*MuteCtl)(uint8_t cmd);
+    int8_t (*EqualizerCtl)(uint8_t band, int8_t gain);   /* gain in dB, or NULL */
     int8_t (*Stop)(void);
     int8_t (*Pause)(void);
     int8_t (*Resume)(void);
     int8_t (*CommandMgr)(uint8_t cmd);
+    int8_t (*VendorGet)(uint8_t request, uint16_t value, uint8_t *data, uint16_t *length);
+    int8_t (*VendorSet)(uint8_t request, uint16_t value, const uint8_t *data, uint16_t length);   /* or NULL */
+    uint32_t (*GetSampleCount)(void);   /* free-running count of captured frames, or NULL */
 } USBD_AUDIO_ItfTypeDef;
 
 extern USBD_ClassTypeDef USBD_AUDIO;
 
 uint8_t USBD_AUDIO_RegisterInterface(USBD_HandleTypeDef *pdev, USBD_AUDIO_ItfTypeDef *fops);
 void USBD_AUDIO_Init_Microphone_Descriptor(USBD_HandleTypeDef *pdev, uint32_t samplingFrequency, uint8_t Channels);
-uint8_t USBD_AUDIO_Data_Transfer(USBD_HandleTypeDef *pdev, int16_t *audioData, uint16_t dataAmount);
+uint8_t USBD_AUDIO_Data_Transfer(USBD_HandleTypeDef *pdev, uint8_t *audioData, uint16_t dataAmount);
+uint8_t* USBD_AUDIO_Reserve_Transfer(USBD_HandleTypeDef *pdev, uint16_t PCMSamples);
+uint8_t USBD_AUDIO_Commit_Transfer(USBD_HandleTypeDef *pdev, uint16_t PCMSamples);
+uint8_t USBD_AUDIO_Suspend(USBD_HandleTypeDef *pdev);
@@ -60,20 +60,23 @@
  *             - Device descriptor management
  *             - Configuration descriptor management
  *             - Standard AC Interface Descriptor management
- *             - 1 Audio Streaming Interface
+ *             - 1 Audio Streaming Interface with 16, 24 and 32 bit alternate settings
  *             - 1 Audio Streaming Endpoint
  *             - 1 Audio Terminal Input
  *             - Audio Class-Specific AC Interfaces
  *             - Audio Class-Specific AS Interfaces
  *             - AudioControl Requests: mute and volume control
- *             - Audio Synchronization type: Asynchronous
+ *             - Endpoint Requests: sampling frequency control
+ *             - Vendor Requests: device-to-host diagnostics supplied by the interface
+ *             - Audio Synchronization type: Asynchronous, with the packet sizes
+ *               following the interface's sample clock as measured against SOF
  *             - Multiple frequencies and channel number configurable using ad hoc
  *               init function
  *
  *          The current audio class version supports the following audio features:
  *             - Pulse Coded Modulation (PCM) format
- *             - Configurable sampling rate
- *             - Bit resolution: 16
+ *             - Sampling rate: 16, 32, 44.1, 48 or 96 kHz, selected by the host
+ *             - Bit resolution: 16, 24 or 32, selected by the alternate setting
  *             - Configurable Number of channels
  *             - Volume control
  *             - Mute/Unmute capability
@@ -126,6 +129,10 @@ static void AUDIO_REQ_SetCurrent(USBD_HandleTypeDef *pdev, USBD_SetupReqTypedef
 static void AUDIO_REQ_GetMaximum(USBD_HandleTypeDef *pdev, USBD_SetupReqTypedef *req);
 static void AUDIO_REQ_GetMinimum(USBD_HandleTypeDef *pdev, USBD_SetupReqTypedef *req);
 static void AUDIO_REQ_GetResolution(USBD_HandleTypeDef *pdev, USBD_SetupReqTypedef *req);
+static void AUDIO_SetAlternateSetting(USBD_HandleTypeDef *pdev, uint8_t alt);
+static void AUDIO_SetSamplingFrequency(USBD_HandleTypeDef *pdev, uint32_t frequency);
+static void AUDIO_SetEqualizer(USBD_HandleTypeDef *pdev, const uint8_t *data, uint16_t len);
+static uint32_t AUDIO_GetPacketLength(USBD_AUDIO_HandleTypeDef *haudio, uint32_t level);
 
 /**
  * @}
@@ -135,12 +142,22 @@ static void AUDIO_REQ_GetResolution(USBD_HandleTypeDef *pdev, USBD_SetupReqTyped
  * @{
  */
 /* This dummy buffer with 0 values will be sent when there is no availble data */
-static uint8_t IsocInBuffDummy[48 * 4 * 2];
+static uint8_t IsocInBuffDummy[(AUDIO_MAX_SAMPLING_FREQUENCY / 1000 + 2) * 4 * 2];
 static int16_t VOL_CUR;
+static uint8_t MUTE_CUR;
 static uint8_t EQ_CUR[36];
+__ALIGN_BEGIN static uint8_t VendorBuffer[AUDIO_VENDOR_BUFFER_SIZE] __ALIGN_END;
+/* Storage for the FIFO that feeds the isochronous endpoint. Its size is fixed so the streaming path never allocates */
+__ALIGN_BEGIN static uint8_t AUDIO_InBuffer[AUDIO_IN_BUFFER_SIZE] __ALIGN_END;
 
 static USBD_AUDIO_HandleTypeDef haudioInstance;
 
+/* Bytes per sample for each streaming alternate setting */
+static const uint8_t AUDIO_SubframeSizes[AUDIO_ALT_SETTING_COUNT] = { 2, 3, 4 };
+
+/* Sampling frequencies offered by every streaming alternate setting */
+static const uint32_t AUDIO_SamplingFrequencies[AUDIO_SAMPLING_FREQUENCY_COUNT] = { 16000, 32000, 44100, 48000, 96000 };
+
 greq_dynamic_param_t *pEqualizerParams;
 
 USBD_ClassTypeDef USBD_AUDIO = { USBD_AUDIO_Init, USBD_AUDIO_DeInit, USBD_AUDIO_Setup, USBD_AUDIO_EP0_TxReady,
@@ -182,12 +199,11 @@ static uint8_t USBD_AUDIO_Init(USBD_HandleTypeDef *pdev, uint8_t cfgidx) {
   pdev->pClassData = &haudioInstance;
   haudio = (USBD_AUDIO_HandleTypeDef*) pdev->pClassData;
   uint16_t packet_dim = haudio->paketDimension;
-  uint16_t wr_rd_offset = (AUDIO_IN_PACKET_NUM / 2) * haudio->dataAmount / haudio->paketDimension;
-  haudio->wr_ptr = wr_rd_offset * packet_dim;
-  haudio->rd_ptr = 0;
+  AUDIO_FIFO_Reset(&haudio->fifo);
+  haudio->in_flight = 0;
   haudio->timeout = 0;
 
-  ((USBD_AUDIO_ItfTypeDef*) pdev->pUserData)->Init(haudio->frequency, 0, haudio->channels);
+  ((USBD_AUDIO_ItfTypeDef*) pdev->pUserData)->Init(haudio->frequency, haudio->subframe_size * 8, haudio->channels);
 
   USBD_LL_OpenEP(pdev,
   AUDIO_IN_EP,
@@ -264,6 +280,31 @@ static uint8_t USBD_AUDIO_Setup(USBD_HandleTypeDef *pdev, USBD_SetupReqTypedef *
     }
     break;
 
+    /* Vendor Requests: the data is supplied or consumed by the interface ----*/
+  case USB_REQ_TYPE_VENDOR:
+    if ((req->bmRequest & 0x80U) == 0) {
+      /* host-to-device: the data is passed on when it has all arrived */
+      if (req->wLength == 0 || req->wLength > AUDIO_VENDOR_BUFFER_SIZE ||
+          ((USBD_AUDIO_ItfTypeDef*) pdev->pUserData)->VendorSet == NULL) {
+        USBD_CtlError(pdev, req);
+        return USBD_FAIL;
+      }
+      haudio->control.cmd = AUDIO_CTRL_REQ_VENDOR_SET;
+      haudio->control.len = req->wLength;
+      haudio->control.unit = req->bRequest;
+      haudio->control.value = req->wValue;
+      USBD_CtlPrepareRx(pdev, VendorBuffer, req->wLength);
+      break;
+    }
+    len = MIN(req->wLength, AUDIO_VENDOR_BUFFER_SIZE);
+    if (len == 0 ||
+        ((USBD_AUDIO_ItfTypeDef*) pdev->pUserData)->VendorGet(req->bRequest, req->wValue, VendorBuffer, &len) != USBD_OK) {
+      USBD_CtlError(pdev, req);
+      return USBD_FAIL;
+    }
+    USBD_CtlSendData(pdev, VendorBuffer, len);
+    break;
+
     /* Standard Requests -------------------------------*/
   case USB_REQ_TYPE_STANDARD:
     switch (req->bRequest) {
@@ -278,12 +319,15 @@ static uint8_t USBD_AUDIO_Setup(USBD_HandleTypeDef *pdev, USBD_SetupReqTypedef *
       break;
 
     case USB_REQ_GET_INTERFACE:
-      USBD_CtlSendData(pdev, (uint8_t*) haudio->alt_setting, 1);
+      USBD_CtlSendData(pdev, (uint8_t*) &haudio->alt_setting, 1);
       break;
 
     case USB_REQ_SET_INTERFACE:
-      if ((uint8_t) (req->wValue) < USBD_MAX_NUM_INTERFACES) {
+      if ((uint8_t) (req->wValue) <= AUDIO_ALT_SETTING_COUNT) {
         haudio->alt_setting = (uint8_t) (req->wValue);
+        if (LOBYTE(req->wIndex) == 0x01 && haudio->alt_setting != 0) {
+          AUDIO_SetAlternateSetting(pdev, haudio->alt_setting);
+        }
       } else {
         /* Call the error management function (command will be nacked */
         USBD_CtlError(pdev, req);
@@ -317,11 +361,8 @@ static uint8_t USBD_AUDIO_DataIn(USBD_HandleTypeDef *pdev, uint8_t epnum) {
   USBD_AUDIO_HandleTypeDef *haudio;
   haudio = pdev->pClassData;
   uint32_t length_usb_pck;
-  uint16_t app;
-  uint16_t IsocInWr_app = haudio->wr_ptr;
-  uint16_t true_dim = haudio->buffer_length;
+  uint32_t app;
   uint16_t packet_dim = haudio->paketDimension;
-  uint16_t channels = haudio->channels;
   length_usb_pck = packet_dim;
   haudio->timeout = 0;
   if (epnum == (AUDIO_IN_EP & 0x7F)) {
@@ -330,25 +371,21 @@ static uint8_t USBD_AUDIO_DataIn(USBD_HandleTypeDef *pdev, uint8_t epnum) {
       ((USBD_AUDIO_ItfTypeDef*) pdev->pUserData)->Record();
     }
     if (haudio->state == STATE_USB_BUFFER_WRITE_STARTED) {
-      haudio->rd_ptr = haudio->rd_ptr % (true_dim);
-      if (IsocInWr_app < haudio->rd_ptr) {
-        app = ((true_dim) - haudio->rd_ptr) + IsocInWr_app;
+      /* the previous packet has gone, so the interface may now overwrite it */
+      AUDIO_FIFO_Release(&haudio->fifo, haudio->in_flight);
+      haudio->in_flight = 0;
+      app = AUDIO_FIFO_Count(&haudio->fifo);
+      length_usb_pck = AUDIO_GetPacketLength(haudio, app);
+      if (app >= length_usb_pck) {
+        /* the packet is sent straight from the FIFO and released at the next DataIn */
+        USBD_LL_Transmit(pdev, AUDIO_IN_EP, AUDIO_FIFO_Peek(&haudio->fifo), length_usb_pck);
+        haudio->in_flight = length_usb_pck;
       } else {
-        app = IsocInWr_app - haudio->rd_ptr;
-      }
-      if (app >= (packet_dim * haudio->upper_treshold)) {
-        length_usb_pck += channels * 2;
-      } else if (app <= (packet_dim * haudio->lower_treshold)) {
-        length_usb_pck -= channels * 2;
-      }
-      USBD_LL_Transmit(pdev, AUDIO_IN_EP, (uint8_t*) (&haudio->buffer[haudio->rd_ptr]), length_usb_pck);
-      haudio->rd_ptr += length_usb_pck;
-
-      if (app < haudio->buffer_length / 10) {
+        /* the lead has run out: the interface has stopped sending */
         ((USBD_AUDIO_ItfTypeDef*) pdev->pUserData)->Stop();
         haudio->state = STATE_USB_IDLE;
         haudio->timeout = 0;
-        memset(haudio->buffer, 0, (haudio->buffer_length + haudio->dataAmount));
+        USBD_LL_Transmit(pdev, AUDIO_IN_EP, IsocInBuffDummy, length_usb_pck);
       }
     } else {
       USBD_LL_Transmit(pdev, AUDIO_IN_EP, IsocInBuffDummy, length_usb_pck);
@@ -367,6 +404,27 @@ static uint8_t USBD_AUDIO_DataIn(USBD_HandleTypeDef *pdev, uint8_t epnum) {
 static uint8_t USBD_AUDIO_EP0_RxReady(USBD_HandleTypeDef *pdev) {
 
   USBD_AUDIO_HandleTypeDef *haudio = pdev->pClassData;
+
+  /* the sampling frequency is an endpoint control, not addressed to a unit */
+  if (haudio->control.cmd == AUDIO_CTRL_REQ_SET_CUR_FREQUENCY) {
+    AUDIO_SetSamplingFrequency(pdev, haudio->control.data[0] | (haudio->control.data[1] << 8) | (haudio->control.data[2] << 16));
+    haudio->control.cmd = 0;
+    haudio->control.len = 0;
+    haudio->control.unit = 0;
+    return USBD_OK;
+  }
+
+  /* a vendor request's bRequest is kept in place of the unit. The core completes the status
+     stage whatever is returned here so a rejected request is just ignored. */
+  if (haudio->control.cmd == AUDIO_CTRL_REQ_VENDOR_SET) {
+    ((USBD_AUDIO_ItfTypeDef*) pdev->pUserData)->VendorSet(haudio->control.unit, haudio->control.value, VendorBuffer,
+        haudio->control.len);
+    haudio->control.cmd = 0;
+    haudio->control.len = 0;
+    haudio->control.unit = 0;
+    return USBD_OK;
+  }
+
   if (haudio->control.unit != AUDIO_OUT_STREAMING_CTRL) {
     return USBD_OK;
   }
@@ -381,8 +439,18 @@ static uint8_t USBD_AUDIO_EP0_RxReady(USBD_HandleTypeDef *pdev) {
     haudio->control.data[0] = 0;
     break;
 
+  case AUDIO_CTRL_REQ_SET_CUR_MUTE:
+    ((USBD_AUDIO_ItfTypeDef*) pdev->pUserData)->MuteCtl(MUTE_CUR);
+    haudio->control.cmd = 0;
+    haudio->control.len = 0;
+    haudio->control.unit = 0;
+    break;
+
   case AUDIO_CTRL_REQ_SET_CUR_EQUALIZER:
-    // TODO:
+    AUDIO_SetEqualizer(pdev, EQ_CUR, haudio->control.len);
+    haudio->control.cmd = 0;
+    haudio->control.len = 0;
+    haudio->control.unit = 0;
     break;
   }
 
@@ -401,11 +469,31 @@ static uint8_t USBD_AUDIO_EP0_TxReady(USBD_HandleTypeDef *pdev) {
 }
 /**
  * @brief  USBD_AUDIO_SOF
- *         handle SOF event
+ *         handle SOF event. While streaming, the number of frames that the
+ *         interface captures in each window of 2^AUDIO_RATE_WINDOW_SHIFT USB
+ *         frames gives its sample rate in the host's time base.
  * @param  pdev: device instance
  * @retval status
  */
 static uint8_t USBD_AUDIO_SOF(USBD_HandleTypeDef *pdev) {
+
+  USBD_AUDIO_HandleTypeDef *haudio = pdev->pClassData;
+  USBD_AUDIO_ItfTypeDef *itf = (USBD_AUDIO_ItfTypeDef*) pdev->pUserData;
+
+  if (haudio == NULL || haudio->state != STATE_USB_BUFFER_WRITE_STARTED || itf->GetSampleCount == NULL) {
+    return USBD_OK;
+  }
+
+  uint32_t count = itf->GetSampleCount();
+
+  if (haudio->sof_count == 0) {
+    haudio->window_start = count;
+  } else if (haudio->sof_count == (1U << AUDIO_RATE_WINDOW_SHIFT)) {
+    haudio->feedback = (count - haudio->window_start) << (16 - AUDIO_RATE_WINDOW_SHIFT);
+    haudio->window_start = count;
+    haudio->sof_count = 0;
+  }
+  haudio->sof_count++;
   return USBD_OK;
 }
 
@@ -462,27 +550,29 @@ static void AUDIO_REQ_GetMaximum(USBD_HandleTypeDef *pdev, USBD_SetupReqTypedef
 
   USBD_AUDIO_HandleTypeDef *haudio = pdev->pClassData;
   uint8_t bControlSelector = req->wValue >> 8;
+  uint16_t len = req->wLength;
 
   switch (bControlSelector) {
 
-  case FEATURE_VOLUME:
+  case AUDIO_VOLUME_CONTROL:
     (haudio->control.data)[0] = (uint16_t) VOL_MAX & 0xFF;
     (haudio->control.data)[1] = ((uint16_t) VOL_MAX & 0xFF00) >> 8;
     break;
 
-  case FEATURE_GRAPHIC_EQ:
+  case AUDIO_GRAPHIC_EQUALIZER_CONTROL:
     (haudio->control.data)[0] = 0xff;   // the first 10 bands are supported
     (haudio->control.data)[1] = 0x3;
     (haudio->control.data)[2] = 0;
     (haudio->control.data)[3] = 0;
 
-    for (uint8_t i = 0; i < 10; i++) {
+    for (uint8_t i = 0; i < AUDIO_GRAPHIC_EQ_BANDS; i++) {
       (haudio->control.data)[i + 4] = 48;    // max = 12dB, units here are 0.25dB
     }
+    len = MIN(len, AUDIO_GRAPHIC_EQ_PARAM_SIZE);
     break;
   }
 
-  USBD_CtlSendData(pdev, haudio->control.data, req->wLength);
+  USBD_CtlSendData(pdev, haudio->control.data, len);
 }
 
 /**
@@ -496,28 +586,30 @@ static void AUDIO_REQ_GetMinimum(USBD_HandleTypeDef *pdev, USBD_SetupReqTypedef
 
   USBD_AUDIO_HandleTypeDef *haudio = pdev->pClassData;
   uint8_t bControlSelector = req->wValue >> 8;
+  uint16_t len = req->wLength;
 
   switch (bControlSelector) {
 
-  case FEATURE_VOLUME:
+  case AUDIO_VOLUME_CONTROL:
     (haudio->control.data)[0] = (uint16_t) VOL_MIN & 0xFF;
     (haudio->control.data)[1] = ((uint16_t) VOL_MIN & 0xFF00) >> 8;
     /* Send the current mute state */
     break;
 
-  case FEATURE_GRAPHIC_EQ:
+  case AUDIO_GRAPHIC_EQUALIZER_CONTROL:
     (haudio->control.data)[0] = 0xff;   // the first 10 bands are supported
     (haudio->control.data)[1] = 0x3;
     (haudio->control.data)[2] = 0;
     (haudio->control.data)[3] = 0;
 
-    for (uint8_t i = 0; i < 10; i++) {
+    for (uint8_t i = 0; i < AUDIO_GRAPHIC_EQ_BANDS; i++) {
       (haudio->control.data)[i + 4] = 0xD0;    // min = -12dB, units here are 0.25dB (0xD0 == -48)
     }
+    len = MIN(len, AUDIO_GRAPHIC_EQ_PARAM_SIZE);
     break;
   }
 
-  USBD_CtlSendData(pdev, haudio->control.data, req->wLength);
+  USBD_CtlSendData(pdev, haudio->control.data, len);
 }
 
 /**
@@ -531,28 +623,30 @@ static void AUDIO_REQ_GetResolution(USBD_HandleTypeDef *pdev, USBD_SetupReqTyped
 
   USBD_AUDIO_HandleTypeDef *haudio = pdev->pClassData;
   uint8_t bControlSelector = req->wValue >> 8;
+  uint16_t len = req->wLength;
 
   switch (bControlSelector) {
 
-  case FEATURE_VOLUME:
+  case AUDIO_VOLUME_CONTROL:
     (haudio->control.data)[0] = (uint16_t) VOL_RES & 0xFF;
     (haudio->control.data)[1] = ((uint16_t) VOL_RES & 0xFF00) >> 8;
     break;
 
-  case FEATURE_GRAPHIC_EQ:
+  case AUDIO_GRAPHIC_EQUALIZER_CONTROL:
     (haudio->control.data)[0] = 0xff;   // the first 10 bands are supported
     (haudio->control.data)[1] = 0x3;
     (haudio->control.data)[2] = 0;
     (haudio->control.data)[3] = 0;
 
-    for (uint8_t i = 0; i < 10; i++) {
+    for (uint8_t i = 0; i < AUDIO_GRAPHIC_EQ_BANDS; i++) {
       (haudio->control.data)[i + 4] = 4;    // resolution = 1dB, units here are 0.25dB
     }
+    len = MIN(len, AUDIO_GRAPHIC_EQ_PARAM_SIZE);
     break;
 
   }
 
-  USBD_CtlSendData(pdev, haudio->control.data, req->wLength);
+  USBD_CtlSendData(pdev, haudio->control.data, len);
 }
 
 /**
@@ -566,32 +660,47 @@ static void AUDIO_REQ_GetCurrent(USBD_HandleTypeDef *pdev, USBD_SetupReqTypedef
 
   USBD_AUDIO_HandleTypeDef *haudio = pdev->pClassData;
   uint8_t bControlSelector = req->wValue >> 8;
+  uint16_t len = req->wLength;
 
-  char buffer[20];
-  itoa(bControlSelector, buffer, 10);
-  puts(buffer);
+  if ((req->bmRequest & USB_REQ_RECIPIENT_MASK) == USB_REQ_RECIPIENT_ENDPOINT) {
+    if (bControlSelector != AUDIO_SAMPLING_FREQ_CONTROL) {
+      USBD_CtlError(pdev, req);
+      return;
+    }
+    (haudio->control.data)[0] = haudio->frequency & 0xFF;
+    (haudio->control.data)[1] = (haudio->frequency >> 8) & 0xFF;
+    (haudio->control.data)[2] = (haudio->frequency >> 16) & 0xFF;
+    USBD_CtlSendData(pdev, haudio->control.data, MIN(req->wLength, 3));
+    return;
+  }
 
   switch (bControlSelector) {
 
-  case FEATURE_VOLUME:
+  case AUDIO_MUTE_CONTROL:
+    (haudio->control.data)[0] = MUTE_CUR;
+    len = MIN(len, 1);
+    break;
+
+  case AUDIO_VOLUME_CONTROL:
     (haudio->control.data)[0] = (uint16_t) VOL_CUR & 0xFF;
     (haudio->control.data)[1] = ((uint16_t) VOL_CUR & 0xFF00) >> 8;
     break;
 
-  case FEATURE_GRAPHIC_EQ:
+  case AUDIO_GRAPHIC_EQUALIZER_CONTROL:
     (haudio->control.data)[0] = 0xff;   // the first 10 bands are supported
     (haudio->control.data)[1] = 0x3;
     (haudio->control.data)[2] = 0;
     (haudio->control.data)[3] = 0;
 
-    for (uint8_t i = 0; i < 10; i++) {
-      (haudio->control.data)[i + 4] = pEqualizerParams->user_gain_per_band_dB[i];
+    for (uint8_t i = 0; i < AUDIO_GRAPHIC_EQ_BANDS; i++) {
+      (haudio->control.data)[i + 4] = pEqualizerParams->user_gain_per_band_dB[i] * 4;   // 1dB to 0.25dB units
     }
+    len = MIN(len, AUDIO_GRAPHIC_EQ_PARAM_SIZE);
     break;
 
   }
 
-  USBD_CtlSendData(pdev, haudio->control.data, req->wLength);
+  USBD_CtlSendData(pdev, haudio->control.data, len);
 }
 
 /**
@@ -612,16 +721,43 @@ static void AUDIO_REQ_SetCurrent(USBD_HandleTypeDef *pdev, USBD_SetupReqTypedef
 
   uint8_t bControlSelector = req->wValue >> 8;
 
+  if ((req->bmRequest & USB_REQ_RECIPIENT_MASK) == USB_REQ_RECIPIENT_ENDPOINT) {
+    if (bControlSelector != AUDIO_SAMPLING_FREQ_CONTROL || req->wLength != 3) {
+      USBD_CtlError(pdev, req);
+      return;
+    }
+    haudio->control.cmd = AUDIO_CTRL_REQ_SET_CUR_FREQUENCY; /* Set the request value */
+    haudio->control.len = req->wLength; /* Set the request data length */
+    haudio->control.unit = LOBYTE(req->wIndex); /* Set the request target endpoint */
+    USBD_CtlPrepareRx(pdev, haudio->control.data, req->wLength);
+    return;
+  }
+
   switch (bControlSelector) {
 
-  case FEATURE_VOLUME:
+  case AUDIO_MUTE_CONTROL:
+    if (req->wLength != 1) {
+      USBD_CtlError(pdev, req);
+      return;
+    }
+    haudio->control.cmd = AUDIO_CTRL_REQ_SET_CUR_MUTE; /* Set the request value */
+    haudio->control.len = req->wLength; /* Set the request data length */
+    haudio->control.unit = HIBYTE(req->wIndex); /* Set the request target unit */
+    USBD_CtlPrepareRx(pdev, &MUTE_CUR, req->wLength);
+    break;
+
+  case AUDIO_VOLUME_CONTROL:
     haudio->control.cmd = AUDIO_CTRL_REQ_SET_CUR_VOLUME; /* Set the request value */
     haudio->control.len = req->wLength; /* Set the request data length */
     haudio->control.unit = HIBYTE(req->wIndex); /* Set the request target unit */
     USBD_CtlPrepareRx(pdev, (uint8_t*) &VOL_CUR, req->wLength);
     break;
 
-  case FEATURE_GRAPHIC_EQ:
+  case AUDIO_GRAPHIC_EQUALIZER_CONTROL:
+    if (req->wLength < 4 || req->wLength > sizeof(EQ_CUR)) {
+      USBD_CtlError(pdev, req);
+      return;
+    }
     haudio->control.cmd = AUDIO_CTRL_REQ_SET_CUR_EQUALIZER; /* Set the request value */
     haudio->control.len = req->wLength; /* Set the request data length */
     haudio->control.unit = HIBYTE(req->wIndex); /* Set the request target unit */
@@ -630,6 +766,139 @@ static void AUDIO_REQ_SetCurrent(USBD_HandleTypeDef *pdev, USBD_SetupReqTypedef
   }
 }
 
+/**
+ * @brief  AUDIO_SetAlternateSetting
+ *         Switches the streaming format to the subframe size of a streaming
+ *         alternate setting. A running stream restarts its buffering at the
+ *         next transfer from the interface.
+ * @param  pdev: instance
+ * @param  alt: alternate setting, 1..AUDIO_ALT_SETTING_COUNT
+ * @retval None
+ */
+static void AUDIO_SetAlternateSetting(USBD_HandleTypeDef *pdev, uint8_t alt) {
+
+  USBD_AUDIO_HandleTypeDef *haudio = pdev->pClassData;
+  uint8_t subframe_size = AUDIO_SubframeSizes[alt - 1];
+
+  if (subframe_size == haudio->subframe_size) {
+    return;
+  }
+
+  haudio->subframe_size = subframe_size;
+  haudio->paketDimension = haudio->frequency / 1000 * haudio->channels * subframe_size;
+
+  if (haudio->state == STATE_USB_BUFFER_WRITE_STARTED) {
+    haudio->state = STATE_USB_REQUESTS_STARTED;
+  }
+
+  ((USBD_AUDIO_ItfTypeDef*) pdev->pUserData)->Init(haudio->frequency, subframe_size * 8, haudio->channels);
+}
+
+/**
+ * @brief  AUDIO_SetSamplingFrequency
+ *         Switches the stream to one of the advertised sampling frequencies.
+ *         The interface reclocks the audio source and a running stream
+ *         restarts its buffering at the next transfer from the interface.
+ * @param  pdev: instance
+ * @param  frequency: sampling frequency in Hz
+ * @retval None
+ */
+static void AUDIO_SetSamplingFrequency(USBD_HandleTypeDef *pdev, uint32_t frequency) {
+
+  USBD_AUDIO_HandleTypeDef *haudio = pdev->pClassData;
+  uint8_t i;
+
+  for (i = 0; i < AUDIO_SAMPLING_FREQUENCY_COUNT && AUDIO_SamplingFrequencies[i] != frequency; i++)
+    ;
+
+  if (i == AUDIO_SAMPLING_FREQUENCY_COUNT || frequency == haudio->frequency) {
+    return;
+  }
+
+  haudio->frequency = frequency;
+  haudio->paketDimension = frequency / 1000 * haudio->channels * haudio->subframe_size;
+
+  if (haudio->state == STATE_USB_BUFFER_WRITE_STARTED) {
+    haudio->state = STATE_USB_REQUESTS_STARTED;
+  }
+
+  ((USBD_AUDIO_ItfTypeDef*) pdev->pUserData)->Init(frequency, haudio->subframe_size * 8, haudio->channels);
+}
+
+/**
+ * @brief  AUDIO_SetEqualizer
+ *         Applies a graphic equalizer SET_CUR parameter block. The gain for each
+ *         band present in bmBandsPresent follows it in band order. A block that
+ *         names an unsupported band or doesn't match its length is ignored
+ *         because the status stage can no longer be stalled. Gains are rounded
+ *         to the 1dB resolution and limited to the advertised range.
+ * @param  pdev: instance
+ * @param  data: bmBandsPresent followed by the gains in 0.25dB units
+ * @param  len: length of the data stage
+ * @retval None
+ */
+static void AUDIO_SetEqualizer(USBD_HandleTypeDef *pdev, const uint8_t *data, uint16_t len) {
+
+  USBD_AUDIO_ItfTypeDef *itf = (USBD_AUDIO_ItfTypeDef*) pdev->pUserData;
+  uint32_t bands = data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t) data[3] << 24);
+  uint16_t count = 0;
+  uint8_t i;
+
+  for (i = 0; i < 32; i++) {
+    count += (bands >> i) & 1;
+  }
+
+  if (itf->EqualizerCtl == NULL || (bands >> AUDIO_GRAPHIC_EQ_BANDS) != 0 || len != 4 + count) {
+    return;
+  }
+
+  data += 4;
+
+  for (i = 0; i < AUDIO_GRAPHIC_EQ_BANDS; i++) {
+    if (bands & (1 << i)) {
+
+      int8_t gain = ((int8_t) *data++ + 2) >> 2;
+
+      if (gain < -12) {
+        gain = -12;
+      } else if (gain > 12) {
+        gain = 12;
+      }
+      itf->EqualizerCtl(i, gain);
+    }
+  }
+}
+
+/**
+ * @brief  AUDIO_GetPacketLength
+ *         Sizes the next isochronous packet. The measured rate is accumulated
+ *         with its fraction so that, for example, 44.1 kHz gives nine packets
+ *         of 44 samples then one of 45. A small correction proportional to the
+ *         distance of the FIFO level from its target takes up the measurement
+ *         error and the drift before the first measurement.
+ * @param  haudio: audio handle
+ * @param  level: bytes in the FIFO
+ * @retval packet length in bytes
+ */
+static uint32_t AUDIO_GetPacketLength(USBD_AUDIO_HandleTypeDef *haudio, uint32_t level) {
+
+  uint32_t frame_size = haudio->channels * haudio->subframe_size;
+  int32_t correction = ((int32_t) (level / frame_size) - (int32_t) haudio->target) * AUDIO_LEVEL_GAIN;
+
+  /* never more than half a sample either way so a packet can't exceed wMaxPacketSize */
+  if (correction > 0x8000) {
+    correction = 0x8000;
+  } else if (correction < -0x8000) {
+    correction = -0x8000;
+  }
+
+  haudio->accumulator += haudio->feedback + correction;
+  uint32_t samples = haudio->accumulator >> 16;
+  haudio->accumulator &= 0xFFFF;
+
+  return samples * frame_size;
+}
+
 /**
  * @}
  */
@@ -642,47 +911,87 @@ static void AUDIO_REQ_SetCurrent(USBD_HandleTypeDef *pdev, USBD_SetupReqTypedef
  * @brief  USBD_AUDIO_Data_Transfer
  *         Fills the USB internal buffer with audio data from user
  * @param pdev: device instance
- * @param audioData: audio data to be sent via USB
+ * @param audioData: audio data to be sent via USB, packed in the subframe size of
+ *        the current alternate setting
  * @param dataAmount: number of PCM samples to be copied
  * @note Depending on the calling frequency, a coherent amount of samples must be passed to
  *       the function. E.g.: assuming a Sampling frequency of 16 KHz and 1 channel,
  *       you can pass 16 PCM samples if the function is called each millisecond,
- *       32 samples if called every 2 milliseconds and so on.
+ *       32 samples if called every 2 milliseconds and so on. At 44.1 KHz the amount
+ *       need not be a whole number of packets: 441 samples every 10 milliseconds.
+ *       Callers that can produce the data in place should use USBD_AUDIO_Reserve_Transfer
+ *       and USBD_AUDIO_Commit_Transfer instead to avoid the copy.
  * @retval status
  */
-uint8_t USBD_AUDIO_Data_Transfer(USBD_HandleTypeDef *pdev, int16_t *audioData, uint16_t PCMSamples) {
+uint8_t USBD_AUDIO_Data_Transfer(USBD_HandleTypeDef *pdev, uint8_t *audioData, uint16_t PCMSamples) {
 
   USBD_AUDIO_HandleTypeDef *haudio;
   haudio = (USBD_AUDIO_HandleTypeDef*) pdev->pClassData;
+  uint8_t *data;
 
   if (haudioInstance.state == STATE_USB_WAITING_FOR_INIT) {
     return USBD_BUSY;
   }
-  uint16_t dataAmount = PCMSamples * 2; /*Bytes*/
-  uint16_t true_dim = haudio->buffer_length;
+  if (PCMSamples * haudio->subframe_size > AUDIO_IN_MAX_TRANSFER_SIZE) {
+    return USBD_FAIL;
+  }
+  if ((data = USBD_AUDIO_Reserve_Transfer(pdev, PCMSamples)) == NULL) {
+    return USBD_OK;
+  }
+  memcpy(data, audioData, PCMSamples * haudio->subframe_size);
+  return USBD_AUDIO_Commit_Transfer(pdev, PCMSamples);
+}
+
+/**
+ * @brief  USBD_AUDIO_Reserve_Transfer
+ *         Reserves space in the USB internal buffer for the interface to write the
+ *         next transfer in place. The first transfer of a stream is preceded by
+ *         AUDIO_IN_LEAD_MS of silence and restarts the rate measurement.
+ * @param pdev: device instance
+ * @param PCMSamples: number of PCM samples that will be written, with the same
+ *        constraints as USBD_AUDIO_Data_Transfer
+ * @retval contiguous space for PCMSamples in the subframe size of the current
+ *         alternate setting, or NULL if the transfer is to be dropped because the
+ *         endpoint is not streaming or the buffer is full
+ */
+uint8_t* USBD_AUDIO_Reserve_Transfer(USBD_HandleTypeDef *pdev, uint16_t PCMSamples) {
+
+  USBD_AUDIO_HandleTypeDef *haudio;
+  haudio = (USBD_AUDIO_HandleTypeDef*) pdev->pClassData;
+
+  if (haudioInstance.state == STATE_USB_WAITING_FOR_INIT || PCMSamples * haudio->subframe_size > AUDIO_IN_MAX_TRANSFER_SIZE) {
+    return NULL;
+  }
+  uint16_t dataAmount = PCMSamples * haudio->subframe_size; /*Bytes*/
   uint16_t current_data_Amount = haudio->dataAmount;
-  uint16_t packet_dim = haudio->paketDimension;
 
   if (haudio->state == STATE_USB_REQUESTS_STARTED || current_data_Amount != dataAmount) {
 
-    /*USB parameters definition, based on the amount of data passed*/
-    haudio->dataAmount = dataAmount;
-    uint16_t wr_rd_offset = (AUDIO_IN_PACKET_NUM / 2) * dataAmount / packet_dim;
-    haudio->wr_ptr = wr_rd_offset * packet_dim;
-    haudio->rd_ptr = 0;
-    haudio->upper_treshold = wr_rd_offset + 1;
-    haudio->lower_treshold = wr_rd_offset - 1;
-    haudio->buffer_length = (packet_dim * (dataAmount / packet_dim) * AUDIO_IN_PACKET_NUM);
-
-    /*Memory allocation for data buffer, depending (also) on data amount passed to the transfer function*/
-    if (haudio->buffer != NULL) {
-      USBD_free(haudio->buffer);
-    }
-    haudio->buffer = USBD_malloc(haudio->buffer_length + haudio->dataAmount);
-    if (haudio->buffer == NULL) {
-      return USBD_FAIL;
+    /*The endpoint must be sending silence before the FIFO is reset. Only the state change
+      to STATE_USB_BUFFER_WRITE_STARTED, below, can send it back to the FIFO.*/
+    if (haudio->state == STATE_USB_BUFFER_WRITE_STARTED) {
+      haudio->state = STATE_USB_REQUESTS_STARTED;
+      __DMB();
     }
-    memset(haudio->buffer, 0, (haudio->buffer_length + haudio->dataAmount));
+
+    /*USB parameters definition, based on the amount of data passed. The level averages the
+      lead plus half a transfer, and the nominal rate is used until the first measurement.*/
+    uint32_t lead = haudio->frequency * AUDIO_IN_LEAD_MS / 1000;
+    haudio->dataAmount = dataAmount;
+    haudio->target = lead + PCMSamples / haudio->channels / 2;
+    haudio->feedback = (uint32_t) (((uint64_t) haudio->frequency << 16) / 1000);
+    haudio->accumulator = 0;
+    haudio->sof_count = 0;
+
+    /*The endpoint is sending silence so the consumer's side of the FIFO can be reset from
+      here, even though the USB interrupt can preempt this one.*/
+    AUDIO_FIFO_Reset(&haudio->fifo);
+    haudio->in_flight = 0;
+    lead *= haudio->channels * haudio->subframe_size;
+    memset(AUDIO_FIFO_Reserve(&haudio->fifo, lead), 0, lead);
+    AUDIO_FIFO_Commit(&haudio->fifo, lead);
+    haudio->timeout = 0;
+    __DMB();
     haudio->state = STATE_USB_BUFFER_WRITE_STARTED;
 
   } else if (haudio->state == STATE_USB_BUFFER_WRITE_STARTED) {
@@ -690,17 +999,61 @@ uint8_t USBD_AUDIO_Data_Transfer(USBD_HandleTypeDef *pdev, int16_t *audioData, u
       haudio->state = STATE_USB_IDLE;
       ((USBD_AUDIO_ItfTypeDef*) pdev->pUserData)->Stop();
       haudio->timeout = 0;
+      return NULL;
     }
-    memcpy((uint8_t*) &haudio->buffer[haudio->wr_ptr], (uint8_t*) (audioData), dataAmount);
-    haudio->wr_ptr += dataAmount;
-    haudio->wr_ptr = haudio->wr_ptr % (true_dim);
-    if ((haudio->wr_ptr - dataAmount) == 0) {
-      memcpy((uint8_t*) (((uint8_t*) haudio->buffer) + true_dim), (uint8_t*) haudio->buffer, dataAmount);
-    }
+  } else {
+    return NULL;
+  }
+  haudio->reserved = dataAmount;
+  return AUDIO_FIFO_Reserve(&haudio->fifo, dataAmount);
+}
+
+/**
+ * @brief  USBD_AUDIO_Commit_Transfer
+ *         Makes a transfer written through USBD_AUDIO_Reserve_Transfer available
+ *         to the endpoint. The USB interrupt may have stopped or reconfigured the
+ *         stream since the reservation, in which case the transfer is dropped.
+ * @param pdev: device instance
+ * @param PCMSamples: number of PCM samples written, as passed to the reservation
+ * @retval status
+ */
+uint8_t USBD_AUDIO_Commit_Transfer(USBD_HandleTypeDef *pdev, uint16_t PCMSamples) {
+
+  USBD_AUDIO_HandleTypeDef *haudio;
+  haudio = (USBD_AUDIO_HandleTypeDef*) pdev->pClassData;
+
+  if (haudio->state == STATE_USB_BUFFER_WRITE_STARTED && haudio->reserved == PCMSamples * haudio->subframe_size) {
+    AUDIO_FIFO_Commit(&haudio->fifo, haudio->reserved);
   }
   return USBD_OK;
 }
 
+/**
+ * @brief  USBD_AUDIO_Suspend
+ *         Stops a running stream when the bus is suspended, as the DataIn stage
+ *         does when the lead runs out. The host's first IN token after the
+ *         resume restarts it through the interface's Record callback and the
+ *         first transfer from the interface then resets the FIFO, so nothing
+ *         captured before the suspend is sent.
+ * @param pdev: device instance
+ * @retval status
+ */
+uint8_t USBD_AUDIO_Suspend(USBD_HandleTypeDef *pdev) {
+
+  USBD_AUDIO_HandleTypeDef *haudio;
+  haudio = (USBD_AUDIO_HandleTypeDef*) pdev->pClassData;
+
+  if (haudioInstance.state == STATE_USB_WAITING_FOR_INIT || haudio->state == STATE_USB_IDLE) {
+    return USBD_OK;
+  }
+
+  haudio->state = STATE_USB_IDLE;
+  haudio->timeout = 0;
+  __DMB();
+  ((USBD_AUDIO_ItfTypeDef*) pdev->pUserData)->Stop();
+  return USBD_OK;
+}
+
 /**
  * @brief  USBD_AUDIO_RegisterInterface
  * @param  fops: Audio interface callback
@@ -780,11 +1133,11 @@ void USBD_AUDIO_Init_Microphone_Descriptor(USBD_HandleTypeDef *pdev, uint32_t sa
   USBD_AUDIO_CfgDesc[44] = 0x01; /* bControlSize */
   index = 47;
   if (Channels == 1) {
-    AUDIO_CONTROLS = (FEATURE_VOLUME | FEATURE_GRAPHIC_EQ);
+    AUDIO_CONTROLS = (FEATURE_MUTE | FEATURE_VOLUME | FEATURE_GRAPHIC_EQ);
     USBD_AUDIO_CfgDesc[45] = AUDIO_CONTROLS;
     USBD_AUDIO_CfgDesc[46] = 0x00;
   } else {
-    AUDIO_CONTROLS = (FEATURE_VOLUME | FEATURE_GRAPHIC_EQ);
+    AUDIO_CONTROLS = (FEATURE_MUTE | FEATURE_VOLUME | FEATURE_GRAPHIC_EQ);
     USBD_AUDIO_CfgDesc[45] = 0x00;
     USBD_AUDIO_CfgDesc[46] = AUDIO_CONTROLS;
     USBD_AUDIO_CfgDesc[index] = AUDIO_CONTROLS;
@@ -837,67 +1190,73 @@ void USBD_AUDIO_Init_Microphone_Descriptor(USBD_HandleTypeDef *pdev, uint32_t sa
   USBD_AUDIO_CfgDesc[index++] = AUDIO_SUBCLASS_AUDIOSTREAMING; /* bInterfaceSubClass */
   USBD_AUDIO_CfgDesc[index++] = AUDIO_PROTOCOL_UNDEFINED; /* bInterfaceProtocol */
   USBD_AUDIO_CfgDesc[index++] = 0x00;
-  /* USB Microphone Standard AS Interface Descriptor - Audio Streaming Operational */
-  /* Interface 1, Alternate Setting 1                                           */
-  USBD_AUDIO_CfgDesc[index++] = 9; /* bLength */
-  USBD_AUDIO_CfgDesc[index++] = USB_INTERFACE_DESCRIPTOR_TYPE; /* bDescriptorType */
-  USBD_AUDIO_CfgDesc[index++] = 0x01; /* bInterfaceNumber */
-  USBD_AUDIO_CfgDesc[index++] = 0x01; /* bAlternateSetting */
-  USBD_AUDIO_CfgDesc[index++] = 0x01; /* bNumEndpoints */
-  USBD_AUDIO_CfgDesc[index++] = USB_DEVICE_CLASS_AUDIO; /* bInterfaceClass */
-  USBD_AUDIO_CfgDesc[index++] = AUDIO_SUBCLASS_AUDIOSTREAMING; /* bInterfaceSubClass */
-  USBD_AUDIO_CfgDesc[index++] = AUDIO_PROTOCOL_UNDEFINED; /* bInterfaceProtocol */
-  USBD_AUDIO_CfgDesc[index++] = 0x00; /* iInterface */
-  /* USB Microphone Audio Streaming Interface Descriptor */
-  USBD_AUDIO_CfgDesc[index++] = AUDIO_STREAMING_INTERFACE_DESC_SIZE; /* bLength */
-  USBD_AUDIO_CfgDesc[index++] = AUDIO_INTERFACE_DESCRIPTOR_TYPE; /* bDescriptorType */
-  USBD_AUDIO_CfgDesc[index++] = AUDIO_STREAMING_GENERAL; /* bDescriptorSubtype */
-  USBD_AUDIO_CfgDesc[index++] = 0x03; /* bTerminalLink */
-  USBD_AUDIO_CfgDesc[index++] = 0x01; /* bDelay */
-  USBD_AUDIO_CfgDesc[index++] = 0x01; /* wFormatTag AUDIO_FORMAT_PCM  0x0001*/
-  USBD_AUDIO_CfgDesc[index++] = 0x00;
-  /* USB Microphone Audio Type I Format Interface Descriptor */
-  USBD_AUDIO_CfgDesc[index++] = 0x0B; /* bLength */
-  USBD_AUDIO_CfgDesc[index++] = AUDIO_INTERFACE_DESCRIPTOR_TYPE; /* bDescriptorType */
-  USBD_AUDIO_CfgDesc[index++] = AUDIO_STREAMING_FORMAT_TYPE; /* bDescriptorSubtype */
-  USBD_AUDIO_CfgDesc[index++] = AUDIO_FORMAT_TYPE_I; /* bFormatType */
-  USBD_AUDIO_CfgDesc[index++] = Channels; /* bNrChannels */
-  USBD_AUDIO_CfgDesc[index++] = 0x02; /* bSubFrameSize */
-  USBD_AUDIO_CfgDesc[index++] = 16; /* bBitResolution */
-  USBD_AUDIO_CfgDesc[index++] = 0x01; /* bSamFreqType */
-  USBD_AUDIO_CfgDesc[index++] = samplingFrequency & 0xff; /* tSamFreq 8000 = 0x1F40 */
-  USBD_AUDIO_CfgDesc[index++] = (samplingFrequency >> 8) & 0xff;
-  USBD_AUDIO_CfgDesc[index++] = samplingFrequency >> 16;
-  /* Endpoint 1 - Standard Descriptor */
-  USBD_AUDIO_CfgDesc[index++] = AUDIO_STANDARD_ENDPOINT_DESC_SIZE; /* bLength */
-  USBD_AUDIO_CfgDesc[index++] = 0x05; /* bDescriptorType */
-  USBD_AUDIO_CfgDesc[index++] = AUDIO_IN_EP; /* bEndpointAddress 1 in endpoint*/
-  USBD_AUDIO_CfgDesc[index++] = 0x05; /* bmAttributes */
-  USBD_AUDIO_CfgDesc[index++] = ((samplingFrequency / 1000 + 2) * Channels * 2) & 0xFF; /* wMaxPacketSize */
-  USBD_AUDIO_CfgDesc[index++] = ((samplingFrequency / 1000 + 2) * Channels * 2) >> 8;
-  USBD_AUDIO_CfgDesc[index++] = 0x01; /* bInterval */
-  USBD_AUDIO_CfgDesc[index++] = 0x00; /* bRefresh */
-  USBD_AUDIO_CfgDesc[index++] = 0x00; /* bSynchAddress */
-  /* Endpoint - Audio Streaming Descriptor*/
-  USBD_AUDIO_CfgDesc[index++] = AUDIO_STREAMING_ENDPOINT_DESC_SIZE; /* bLength */
-  USBD_AUDIO_CfgDesc[index++] = AUDIO_ENDPOINT_DESCRIPTOR_TYPE; /* bDescriptorType */
-  USBD_AUDIO_CfgDesc[index++] = AUDIO_ENDPOINT_GENERAL; /* bDescriptor */
-  USBD_AUDIO_CfgDesc[index++] = 0x00; /* bmAttributes */
-  USBD_AUDIO_CfgDesc[index++] = 0x00; /* bLockDelayUnits */
-  USBD_AUDIO_CfgDesc[index++] = 0x00; /* wLockDelay */
-  USBD_AUDIO_CfgDesc[index++] = 0x00;
+  /* USB Microphone Standard AS Interface Descriptors - Audio Streaming Operational */
+  /* Interface 1, Alternate Settings 1..AUDIO_ALT_SETTING_COUNT, one per subframe size */
+  for (uint8_t alt = 1; alt <= AUDIO_ALT_SETTING_COUNT; alt++) {
+    uint8_t subframeSize = AUDIO_SubframeSizes[alt - 1];
+    uint16_t maxPacketSize = (AUDIO_MAX_SAMPLING_FREQUENCY / 1000 + 2) * Channels * subframeSize;
+
+    USBD_AUDIO_CfgDesc[index++] = 9; /* bLength */
+    USBD_AUDIO_CfgDesc[index++] = USB_INTERFACE_DESCRIPTOR_TYPE; /* bDescriptorType */
+    USBD_AUDIO_CfgDesc[index++] = 0x01; /* bInterfaceNumber */
+    USBD_AUDIO_CfgDesc[index++] = alt; /* bAlternateSetting */
+    USBD_AUDIO_CfgDesc[index++] = 0x01; /* bNumEndpoints */
+    USBD_AUDIO_CfgDesc[index++] = USB_DEVICE_CLASS_AUDIO; /* bInterfaceClass */
+    USBD_AUDIO_CfgDesc[index++] = AUDIO_SUBCLASS_AUDIOSTREAMING; /* bInterfaceSubClass */
+    USBD_AUDIO_CfgDesc[index++] = AUDIO_PROTOCOL_UNDEFINED; /* bInterfaceProtocol */
+    USBD_AUDIO_CfgDesc[index++] = 0x00; /* iInterface */
+    /* USB Microphone Audio Streaming Interface Descriptor */
+    USBD_AUDIO_CfgDesc[index++] = AUDIO_STREAMING_INTERFACE_DESC_SIZE; /* bLength */
+    USBD_AUDIO_CfgDesc[index++] = AUDIO_INTERFACE_DESCRIPTOR_TYPE; /* bDescriptorType */
+    USBD_AUDIO_CfgDesc[index++] = AUDIO_STREAMING_GENERAL; /* bDescriptorSubtype */
+    USBD_AUDIO_CfgDesc[index++] = 0x03; /* bTerminalLink */
+    USBD_AUDIO_CfgDesc[index++] = 0x01; /* bDelay */
+    USBD_AUDIO_CfgDesc[index++] = 0x01; /* wFormatTag AUDIO_FORMAT_PCM  0x0001*/
+    USBD_AUDIO_CfgDesc[index++] = 0x00;
+    /* USB Microphone Audio Type I Format Interface Descriptor */
+    USBD_AUDIO_CfgDesc[index++] = 0x08 + AUDIO_SAMPLING_FREQUENCY_COUNT * 3; /* bLength */
+    USBD_AUDIO_CfgDesc[index++] = AUDIO_INTERFACE_DESCRIPTOR_TYPE; /* bDescriptorType */
+    USBD_AUDIO_CfgDesc[index++] = AUDIO_STREAMING_FORMAT_TYPE; /* bDescriptorSubtype */
+    USBD_AUDIO_CfgDesc[index++] = AUDIO_FORMAT_TYPE_I; /* bFormatType */
+    USBD_AUDIO_CfgDesc[index++] = Channels; /* bNrChannels */
+    USBD_AUDIO_CfgDesc[index++] = subframeSize; /* bSubFrameSize */
+    USBD_AUDIO_CfgDesc[index++] = subframeSize * 8; /* bBitResolution */
+    USBD_AUDIO_CfgDesc[index++] = AUDIO_SAMPLING_FREQUENCY_COUNT; /* bSamFreqType */
+    for (uint8_t i = 0; i < AUDIO_SAMPLING_FREQUENCY_COUNT; i++) {
+      USBD_AUDIO_CfgDesc[index++] = AUDIO_SamplingFrequencies[i] & 0xff; /* tSamFreq 8000 = 0x1F40 */
+      USBD_AUDIO_CfgDesc[index++] = (AUDIO_SamplingFrequencies[i] >> 8) & 0xff;
+      USBD_AUDIO_CfgDesc[index++] = AUDIO_SamplingFrequencies[i] >> 16;
+    }
+    /* Endpoint 1 - Standard Descriptor */
+    USBD_AUDIO_CfgDesc[index++] = AUDIO_STANDARD_ENDPOINT_DESC_SIZE; /* bLength */
+    USBD_AUDIO_CfgDesc[index++] = 0x05; /* bDescriptorType */
+    USBD_AUDIO_CfgDesc[index++] = AUDIO_IN_EP; /* bEndpointAddress 1 in endpoint*/
+    USBD_AUDIO_CfgDesc[index++] = 0x05; /* bmAttributes */
+    USBD_AUDIO_CfgDesc[index++] = maxPacketSize & 0xFF; /* wMaxPacketSize */
+    USBD_AUDIO_CfgDesc[index++] = maxPacketSize >> 8;
+    USBD_AUDIO_CfgDesc[index++] = 0x01; /* bInterval */
+    USBD_AUDIO_CfgDesc[index++] = 0x00; /* bRefresh */
+    USBD_AUDIO_CfgDesc[index++] = 0x00; /* bSynchAddress */
+    /* Endpoint - Audio Streaming Descriptor*/
+    USBD_AUDIO_CfgDesc[index++] = AUDIO_STREAMING_ENDPOINT_DESC_SIZE; /* bLength */
+    USBD_AUDIO_CfgDesc[index++] = AUDIO_ENDPOINT_DESCRIPTOR_TYPE; /* bDescriptorType */
+    USBD_AUDIO_CfgDesc[index++] = AUDIO_ENDPOINT_GENERAL; /* bDescriptor */
+    USBD_AUDIO_CfgDesc[index++] = AUDIO_SAMPLING_FREQ_CONTROL; /* bmAttributes: sampling frequency control */
+    USBD_AUDIO_CfgDesc[index++] = 0x00; /* bLockDelayUnits */
+    USBD_AUDIO_CfgDesc[index++] = 0x00; /* wLockDelay */
+    USBD_AUDIO_CfgDesc[index++] = 0x00;
+  }
 
-  haudioInstance.paketDimension = (samplingFrequency / 1000 * Channels * 2);
+  haudioInstance.subframe_size = AUDIO_SubframeSizes[0];
+  haudioInstance.paketDimension = (samplingFrequency / 1000 * Channels * haudioInstance.subframe_size);
   haudioInstance.frequency = samplingFrequency;
-  haudioInstance.buffer_length = haudioInstance.paketDimension * AUDIO_IN_PACKET_NUM;
   haudioInstance.channels = Channels;
-  haudioInstance.upper_treshold = 5;
-  haudioInstance.lower_treshold = 2;
+  haudioInstance.feedback = (uint32_t) (((uint64_t) samplingFrequency << 16) / 1000);
+  haudioInstance.accumulator = 0;
   haudioInstance.state = STATE_USB_WAITING_FOR_INIT;
-  haudioInstance.wr_ptr = 3 * haudioInstance.paketDimension;
-  haudioInstance.rd_ptr = 0;
+  haudioInstance.in_flight = 0;
   haudioInstance.dataAmount = 0;
-  haudioInstance.buffer = 0;
+  AUDIO_FIFO_Init(&haudioInstance.fifo, AUDIO_InBuffer, AUDIO_IN_FIFO_SIZE, AUDIO_IN_MAX_TRANSFER_SIZE);
 }
 
 /**
@@ -5,24 +5,43 @@ static int8_t Audio_DeInit(uint32_t options);
 static int8_t Audio_Record();
 static int8_t Audio_VolumeCtl(int16_t Volume);
 static int8_t Audio_MuteCtl(uint8_t cmd);
+static int8_t Audio_EqualizerCtl(uint8_t band, int8_t gain);
 static int8_t Audio_Stop();
 static int8_t Audio_Pause();
 static int8_t Audio_Resume();
 static int8_t Audio_CommandMgr(uint8_t cmd);
+static int8_t Audio_VendorGet(uint8_t request, uint16_t value, uint8_t *data, uint16_t *length);
+static int8_t Audio_VendorSet(uint8_t request, uint16_t value, const uint8_t *data, uint16_t length);
+static uint32_t Audio_GetSampleCount();
 
 USBD_AUDIO_ItfTypeDef USBD_AUDIO_fops = { Audio_Init, Audio_DeInit, Audio_Record, Audio_VolumeCtl, Audio_MuteCtl,
-    Audio_Stop, Audio_Pause, Audio_Resume, Audio_CommandMgr, };
+    Audio_EqualizerCtl, Audio_Stop, Audio_Pause, Audio_Resume, Audio_CommandMgr, Audio_VendorGet, Audio_VendorSet,
+    Audio_GetSampleCount, };
 
 /**
- * @brief  Initializes the AUDIO media low layer over USB FS IP
- * @param  AudioFreq: Audio frequency used to play the audio stream.
- * @param  Volume: Initial volume level (from 0 (Mute) to 100 (Max))
- * @param  options: Reserved for future use
+ * @brief  Initializes the AUDIO media low layer over USB FS IP. Called when the device is
+ *         configured and again when the host selects a streaming alternate setting or a
+ *         sampling frequency.
+ * @param  AudioFreq: Sampling frequency selected by the host
+ * @param  BitRes: Bits per sample of the selected streaming format (16, 24 or 32)
+ * @param  ChnlNbr: Number of channels
  * @retval USBD_OK if all operations are OK else USBD_FAIL
  */
 
-static int8_t Audio_Init(uint32_t AudioFreq, uint32_t Volume, uint32_t options) {
+static int8_t Audio_Init(uint32_t AudioFreq, uint32_t BitRes, uint32_t ChnlNbr) {
+
   HAL_GPIO_WritePin(LINK_LED_GPIO_Port, LINK_LED_Pin, GPIO_PIN_SET);
+
+  // the device can be configured before the Audio instance has been constructed. It starts in
+  // 16 bit mode at MIC_SAMPLE_FREQUENCY.
+
+  if (Audio::_instance) {
+    Audio::_instance->setSubframeSize(BitRes / 8);
+
+    if (Audio::_instance->setSampleRate(AudioFreq) != HAL_OK) {
+      return USBD_FAIL;
+    }
+  }
   return USBD_OK;
 }
 
@@ -58,11 +77,24 @@ static int8_t Audio_VolumeCtl(int16_t vol) {
 
 /**
  * @brief  Controls AUDIO Mute.
- * @param  cmd: command opcode
+ * @param  cmd: the host's mute control, 1 to mute and 0 to unmute
  * @retval USBD_OK if all operations are OK else USBD_FAIL
  */
 
 static int8_t Audio_MuteCtl(uint8_t cmd) {
+  Audio::_instance->setHostMute(cmd != 0);
+  return USBD_OK;
+}
+
+/**
+ * @brief  Controls the graphic equalizer
+ * @param  band: band index, 0..9
+ * @param  gain: gain in dB, -12..12
+ * @retval USBD_OK if all operations are OK else USBD_FAIL
+ */
+
+static int8_t Audio_EqualizerCtl(uint8_t band, int8_t gain) {
+  Audio::_instance->setEqualizerBand(band, gain);
   return USBD_OK;
 }
 
@@ -107,7 +139,150 @@ static int8_t Audio_CommandMgr(uint8_t cmd) {
 }
 
 /**
- * Implement the HAL interrupt callbacks that process completed milliseconds of data
+ * @brief  Supplies the data for a device-to-host vendor request
+ * @param  request: bRequest
+ * @param  value: wValue
+ * @param  data: buffer to fill
+ * @param  length: in: the maximum length, out: the actual length
+ * @retval USBD_OK if the request is supported else USBD_FAIL
+ */
+
+static int8_t Audio_VendorGet(uint8_t request, uint16_t value, uint8_t *data, uint16_t *length) {
+
+  switch (request) {
+
+  case MIC_VENDOR_REQ_GET_PROFILE: {
+
+    ProfilerReport report;
+    Profiler &profiler = Audio::_instance->getProfiler();
+
+    profiler.getReport(report);
+
+    if (*length > sizeof(report)) {
+      *length = sizeof(report);
+    }
+    memcpy(data, &report, *length);
+
+    if (value == 1) {
+      profiler.reset();
+    }
+    return USBD_OK;
+  }
+
+  case MIC_VENDOR_REQ_GATE: {
+
+    const NoiseGateSettings &settings = Audio::_instance->getNoiseGate();
+
+    if (*length > sizeof(settings)) {
+      *length = sizeof(settings);
+    }
+    memcpy(data, &settings, *length);
+    return USBD_OK;
+  }
+
+  case MIC_VENDOR_REQ_POWER: {
+
+    PowerReport report;
+
+    if (!PowerManager::_instance) {
+      return USBD_FAIL;
+    }
+
+    PowerManager::_instance->getReport(report);
+
+    if (*length > sizeof(report)) {
+      *length = sizeof(report);
+    }
+    memcpy(data, &report, *length);
+
+    if (value == 1) {
+      PowerManager::_instance->reset();
+    }
+    return USBD_OK;
+  }
+
+  case MIC_VENDOR_REQ_HIGHPASS: {
+
+    HighPassSettings settings = Audio::_instance->getHighPass();
+
+    if (*length > sizeof(settings)) {
+      *length = sizeof(settings);
+    }
+    memcpy(data, &settings, *length);
+    return USBD_OK;
+  }
+
+  default:
+    return USBD_FAIL;
+  }
+}
+
+/**
+ * @brief  Consumes the data of a host-to-device vendor request
+ * @param  request: bRequest
+ * @param  value: wValue
+ * @param  data: the data stage
+ * @param  length: bytes in the data stage
+ * @retval USBD_OK if the request is supported and valid else USBD_FAIL
+ */
+
+static int8_t Audio_VendorSet(uint8_t request, uint16_t value, const uint8_t *data, uint16_t length) {
+
+  switch (request) {
+
+  case MIC_VENDOR_REQ_GATE: {
+
+    NoiseGateSettings settings;
+
+    if (length != sizeof(settings)) {
+      return USBD_FAIL;
+    }
+
+    memcpy(&settings, data, sizeof(settings));
+
+    if (!NoiseGate::validate(settings)) {
+      return USBD_FAIL;
+    }
+
+    Audio::_instance->setNoiseGate(settings);
+    return USBD_OK;
+  }
+
+  case MIC_VENDOR_REQ_HIGHPASS: {
+
+    HighPassSettings settings;
+
+    if (length != sizeof(settings)) {
+      return USBD_FAIL;
+    }
+
+    memcpy(&settings, data, sizeof(settings));
+
+    if (!HighPassFilter::validate(settings)) {
+      return USBD_FAIL;
+    }
+
+    Audio::_instance->setHighPass(settings);
+    return USBD_OK;
+  }
+
+  default:
+    return USBD_FAIL;
+  }
+}
+
+/**
+ * @brief  Counts the frames captured so far, for the class driver to measure the sample rate
+ * @retval free-running frame count
+ */
+
+static uint32_t Audio_GetSampleCount() {
+  return Audio::_instance->getSampleCount();
+}
+
+/**
+ * Implement the HAL interrupt callbacks that publish completed milliseconds of data and the
+ * lowest priority PendSV handler that processes them
  */
 
 extern "C" {
@@ -120,5 +295,9 @@ void HAL_I2S_RxCpltCallback(I2S_HandleTypeDef *hi2s) {
   Audio::_instance->i2s_complete();
 }
 
+void PendSV_Handler() {
+  Audio::_instance->processBlocks();
+}
+
 }
 
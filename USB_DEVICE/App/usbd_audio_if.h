@@ -5,7 +5,34 @@
 #define MIC_SAMPLE_FREQUENCY 48000
 #define MIC_SAMPLES_PER_MS (MIC_SAMPLE_FREQUENCY/1000)  // == 48
 #define MIC_NUM_CHANNELS 1
+
+// the DMA buffer holds MIC_MS_PER_PACKET and each half is processed as one block. The low
+// latency build sets it to 2 so that a block is one USB frame.
+
+#ifndef MIC_MS_PER_PACKET
 #define MIC_MS_PER_PACKET 20
+#endif
+
 #define MIC_SAMPLES_PER_PACKET (MIC_SAMPLES_PER_MS * MIC_MS_PER_PACKET) // == 960
 
+// the host can select any of the rates in the format descriptor. MIC_SAMPLE_FREQUENCY is the
+// rate at power-up and buffers are sized for the highest rate.
+
+#define MIC_MAX_SAMPLE_FREQUENCY AUDIO_MAX_SAMPLING_FREQUENCY
+#define MIC_MAX_SAMPLES_PER_PACKET ((MIC_MAX_SAMPLE_FREQUENCY / 1000) * MIC_MS_PER_PACKET) // == 1920
+
+// the longest time from the wakeup of a suspended bus to the first block of the restarted stream
+// being committed to the USB FIFO. The host drives resume for 20ms and waits 10ms more before it
+// polls the endpoint, then a block has to be captured. 5ms is allowed for the first poll and for
+// restarting the clocks.
+
+#define MIC_RESUME_TARGET_MS (30 + MIC_MS_PER_PACKET / 2 + 5)
+
+// vendor-specific requests (bmRequestType 0xC0 or 0xC1 to read, 0x40 or 0x41 to write)
+
+#define MIC_VENDOR_REQ_GET_PROFILE 0x01   // returns a ProfilerReport. wValue = 1 to reset afterwards
+#define MIC_VENDOR_REQ_GATE 0x02          // reads or writes the NoiseGateSettings
+#define MIC_VENDOR_REQ_POWER 0x03         // returns a PowerReport. wValue = 1 to reset afterwards
+#define MIC_VENDOR_REQ_HIGHPASS 0x04      // reads or writes the HighPassSettings
+
 extern USBD_AUDIO_ItfTypeDef USBD_AUDIO_fops;
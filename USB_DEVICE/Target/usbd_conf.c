@@ -10,6 +10,8 @@ USBD_StatusTypeDef USBD_Get_USB_Status(HAL_StatusTypeDef hal_status);
 
 extern void usb_connected();
 extern void usb_disconnected();
+extern void Power_Suspend(uint8_t stop);
+extern void Power_Resume(uint8_t reset);
 
 /*******************************************************************************
  LL Driver Callbacks (PCD -> USB Device Library)
@@ -37,6 +39,16 @@ void HAL_PCD_MspInit(PCD_HandleTypeDef *pcdHandle) {
     /* Peripheral interrupt init */
     HAL_NVIC_SetPriority(OTG_FS_IRQn, 0, 0);
     HAL_NVIC_EnableIRQ(OTG_FS_IRQn);
+
+    /* The wakeup line brings the core out of stop mode when the host resumes the bus */
+    if (pcdHandle->Init.low_power_enable == 1) {
+      __HAL_USB_OTG_FS_WAKEUP_EXTI_CLEAR_FLAG();
+      __HAL_USB_OTG_FS_WAKEUP_EXTI_ENABLE_RISING_EDGE();
+      __HAL_USB_OTG_FS_WAKEUP_EXTI_ENABLE_IT();
+
+      HAL_NVIC_SetPriority(OTG_FS_WKUP_IRQn, 0, 0);
+      HAL_NVIC_EnableIRQ(OTG_FS_WKUP_IRQn);
+    }
   }
 }
 
@@ -53,6 +65,7 @@ void HAL_PCD_MspDeInit(PCD_HandleTypeDef *pcdHandle) {
 
     /* Peripheral interrupt Deinit*/
     HAL_NVIC_DisableIRQ(OTG_FS_IRQn);
+    HAL_NVIC_DisableIRQ(OTG_FS_WKUP_IRQn);
   }
 }
 
@@ -139,6 +152,9 @@ void HAL_PCD_ResetCallback(PCD_HandleTypeDef *hpcd)
 
   /* Reset Device. */
   USBD_LL_Reset((USBD_HandleTypeDef*) hpcd->pData);
+
+  /* A reset can also end a suspend */
+  Power_Resume(1);
 }
 
 /**
@@ -156,12 +172,10 @@ void HAL_PCD_SuspendCallback(PCD_HandleTypeDef *hpcd)
   /* Inform USB library that core enters in suspend Mode. */
   USBD_LL_Suspend((USBD_HandleTypeDef*) hpcd->pData);
   __HAL_PCD_GATE_PHYCLOCK(hpcd);
-  /* Enter in STOP mode. */
+  HAL_GPIO_WritePin(LINK_LED_GPIO_Port, LINK_LED_Pin, GPIO_PIN_RESET);
+  /* Stop the stream. The main loop then enters STOP mode, or only reduces the clock. */
   /* USER CODE BEGIN 2 */
-  if (hpcd->Init.low_power_enable) {
-    /* Set SLEEPDEEP bit and SleepOnExit of Cortex System Control Register. */
-    SCB->SCR |= (uint32_t) ((uint32_t) (SCB_SCR_SLEEPDEEP_Msk | SCB_SCR_SLEEPONEXIT_Msk));
-  }
+  Power_Suspend(hpcd->Init.low_power_enable);
   /* USER CODE END 2 */
 }
 
@@ -178,9 +192,15 @@ void HAL_PCD_ResumeCallback(PCD_HandleTypeDef *hpcd)
 #endif /* USE_HAL_PCD_REGISTER_CALLBACKS */
 {
   /* USER CODE BEGIN 3 */
-
+  /* The wakeup interrupt normally gets here first, but not if the core wasn't stopped */
+  __HAL_PCD_UNGATE_PHYCLOCK(hpcd);
   /* USER CODE END 3 */
   USBD_LL_Resume((USBD_HandleTypeDef*) hpcd->pData);
+
+  if (((USBD_HandleTypeDef*) hpcd->pData)->dev_state == USBD_STATE_CONFIGURED) {
+    HAL_GPIO_WritePin(LINK_LED_GPIO_Port, LINK_LED_Pin, GPIO_PIN_SET);
+  }
+  Power_Resume(0);
 }
 
 /**
@@ -264,8 +284,8 @@ USBD_StatusTypeDef USBD_LL_Init(USBD_HandleTypeDef *pdev) {
     hpcd_USB_OTG_FS.Init.speed = PCD_SPEED_FULL;
     hpcd_USB_OTG_FS.Init.dma_enable = DISABLE;
     hpcd_USB_OTG_FS.Init.phy_itface = PCD_PHY_EMBEDDED;
-    hpcd_USB_OTG_FS.Init.Sof_enable = DISABLE;
-    hpcd_USB_OTG_FS.Init.low_power_enable = DISABLE;
+    hpcd_USB_OTG_FS.Init.Sof_enable = ENABLE;    /* the audio class measures its sample rate against SOF */
+    hpcd_USB_OTG_FS.Init.low_power_enable = ENABLE;
     hpcd_USB_OTG_FS.Init.lpm_enable = DISABLE;
     hpcd_USB_OTG_FS.Init.vbus_sensing_enable = DISABLE;
     hpcd_USB_OTG_FS.Init.use_dedicated_ep1 = DISABLE;